@@ -1,12 +1,22 @@
 #pragma once
 
 #include <drawing/draw.hpp>
+#include <utils.hpp>
 
 #include <algorithm>
 #include <iostream>
 #include <optional>
 #include <string>
 #include <map>
+#include <utility>
+#include <vector>
+
+enum class IoBackend {
+    automatic,
+    stream,
+    mmap,
+    uring
+};
 
 struct CmdOptions {
     std::optional<std::string> input_filename;
@@ -17,8 +27,29 @@ struct CmdOptions {
 
     ImageFormat image_format = ImageFormat::png;
 
+    size_t threads = 1;
+
+    IoBackend io = IoBackend::automatic;
+
+    ColorMode color_mode = ColorMode::count;
+
     bool verbose = false;
     bool adjust_colors = false;
+    bool pow2_blocks = false;
+    bool pipeline = false;
+    bool no_cache = false;
+    bool tar = false;
+    bool edge_list = false;
+
+    // rows and columns of matrices without a size line
+    std::optional<std::pair<size_t, size_t>> dims;
+};
+
+struct ConvertOptions {
+    std::string input_filename;
+    std::string output_filename;
+
+    bool verbose = false;
 };
 
 const std::string options_help = R"(
@@ -36,13 +67,79 @@ Options
   -a
   --adjust-colors    Compute colors based on the maximum occupancy of blocks
                      instead of based on block capacity.
+  --pow2-blocks      Round the size of blocks up to a power of two, which
+                     makes mapping entries to blocks a bit faster at
+                     the cost of a coarser image.
+  -c <mode>
+  --color-by <mode>  What the color of a block stands for. Can be one of:
+                       count     the number of entries, the default
+                       sum       the sum of their absolute values
+                       max       the largest absolute value
+                       nonzeros  the number of entries which aren't
+                                 explicit zeros
+                     Values are read only from Matrix Market files
+                     in the coordinate format.
   -f <fmt>
   --output-format <fmt>  The format of the output image.
                          Can be on of: png, jpg, bmp, tga, svg
+  -t <n>
+  --threads <n>      The number of threads used to parse the entries.
+                     Only large chunks of input are split among threads,
+                     i.e. mapped files and pipelined input. Also the number
+                     of threads decompressing BGZF and indexed gzip files.
+  -p, --pipeline     Read the input on a separate thread into a ring
+                     of buffers while the entries are being parsed.
+  --io <backend>     How input files are read. Can be one of:
+                       stream  plain reads into a buffer
+                       mmap    memory mapping, the default
+                       uring   io_uring with several reads in flight,
+                               falls back to plain reads if unavailable
+                     The standard input is mapped if it is redirected
+                     from a file, otherwise it is read with plain reads.
+  --no-cache         Read input files without filling the page cache,
+                     using O_DIRECT or evicting what was read. Memory
+                     mapping is replaced by plain reads, except for BGZF
+                     and indexed gzip files, which stay mapped and are
+                     evicted as they are decompressed.
+  --tar              The input is a tar archive, possibly gzipped. Every
+                     matrix in it is rendered into its own image named
+                     after the matrix, '-o' then gives the directory for
+                     the images. Implied by the '.tar', '.tar.gz' and
+                     '.tgz' extensions.
+  --edge-list        The input is a graph given by a list of edges, one
+                     zero-based pair of nodes per line, with comments
+                     starting with '#', like the SNAP datasets. Implied
+                     by the '.el', '.wel' and '.edges' extensions.
+  --dims <rows>x<cols>
+  --dims <n>         The size of the matrix of an edge list. Otherwise it
+                     is found by an extra pass over the input, which
+                     isn't possible for the standard input.
+
+Inputs compressed with gzip (a '.gz' extension or the gzip magic bytes)
+are decompressed on the fly, on a separate thread. BGZF files and files
+accompanied by a '.gzi' index are decompressed on as many threads as
+given by '-t'.
+
+Besides Matrix Market files, the input can be a Rutherford-Boeing or
+Harwell-Boeing file (extensions like '.rb', '.hb' or '.rua'), a matrix
+saved by scipy.sparse.save_npz ('.npz'), a graph serialized by the GAP
+benchmark suite ('.sg' or '.wsg') or a file in the native binary format
+written by the 'convert' command.
+)";
+
+const std::string convert_help = R"(
+Converts a Matrix Market file into the native binary format, which is
+much faster to render repeatedly. Binary files are recognized automatically
+when given as the input.
+
+Options
+  -v                 Enables verbose output.
+  -h, --help         Print usage and exit.
 )";
 
 void print_usage(const std::string& executable_name) {
     std::cout << "Usage: " << executable_name << " <input_file.mtx> -o <output_file.svg>\n";
+    std::cout << "       " << executable_name << " convert <input_file.mtx> <output_file.mbin>\n";
     std::cout << options_help;
 }
 
@@ -73,6 +170,39 @@ std::optional<size_t> parse_integer_argument(std::string_view arg_name, std::str
     return val;
 }
 
+/**
+ * Parses dimensions given as `<rows>x<cols>` or just `<n>` for a square matrix.
+ */
+std::optional<std::pair<size_t, size_t>> parse_dims_argument(std::string_view arg_val) {
+    auto parse = [](std::string_view str, size_t& val) {
+        // any value with at most 19 digits fits
+        if (str.empty() || str.size() > 19) {
+            return false;
+        }
+        val = 0;
+        for (char c : str) {
+            if (c < '0' || c > '9') {
+                return false;
+            }
+            val = val*10 + (c - '0');
+        }
+        return true;
+    };
+
+    size_t rows, cols;
+    size_t split = arg_val.find('x');
+    bool valid = split == std::string_view::npos
+        ? parse(arg_val, rows) && parse(arg_val, cols)
+        : parse(arg_val.substr(0, split), rows) && parse(arg_val.substr(split + 1), cols);
+
+    if (!valid) {
+        std::cerr << "Error: Invalid value '" << arg_val << "' provided for the '--dims' option.\n";
+        return std::nullopt;
+    }
+
+    return std::make_pair(rows, cols);
+}
+
 std::optional<ImageFormat> parse_image_format(std::string format_string) {
     static std::map<std::string, ImageFormat> formats = {
         { "svg", ImageFormat::svg },
@@ -96,6 +226,49 @@ std::optional<ImageFormat> parse_image_format(std::string format_string) {
     return it->second;
 }
 
+std::optional<ColorMode> parse_color_mode(std::string_view mode_string) {
+    static std::map<std::string_view, ColorMode> modes = {
+        { "count", ColorMode::count },
+        { "sum", ColorMode::sum },
+        { "max", ColorMode::max },
+        { "nonzeros", ColorMode::nonzeros },
+    };
+
+    auto it = modes.find(mode_string);
+
+    if (it == modes.end()) {
+        return std::nullopt;
+    }
+
+    return it->second;
+}
+
+std::string color_mode_name(ColorMode mode) {
+    switch (mode) {
+        case ColorMode::count: return "count";
+        case ColorMode::sum: return "sum";
+        case ColorMode::max: return "max";
+        case ColorMode::nonzeros: return "nonzeros";
+    }
+    return "";
+}
+
+std::optional<IoBackend> parse_io_backend(std::string_view backend_string) {
+    static std::map<std::string_view, IoBackend> backends = {
+        { "stream", IoBackend::stream },
+        { "mmap", IoBackend::mmap },
+        { "uring", IoBackend::uring },
+    };
+
+    auto it = backends.find(backend_string);
+
+    if (it == backends.end()) {
+        return std::nullopt;
+    }
+
+    return it->second;
+}
+
 std::optional<CmdOptions> parse_args(int argc, char** argv) {
     CmdOptions opts;
 
@@ -134,6 +307,8 @@ std::optional<CmdOptions> parse_args(int argc, char** argv) {
             }
         } else if (arg == "-a" || arg == "--adjust-colors") {
             opts.adjust_colors = true;
+        } else if (arg == "--pow2-blocks") {
+            opts.pow2_blocks = true;
         } else if (arg == "-f" || arg == "--output-format") {
             if (i >= argc - 1) {
                 std::cerr << "Error: No value specified for '" << arg << "'.\n";
@@ -146,6 +321,67 @@ std::optional<CmdOptions> parse_args(int argc, char** argv) {
                 return std::nullopt;
             }
             opts.image_format = *format;
+        } else if (arg == "--io" || arg.substr(0, 5) == "--io=") {
+            std::string_view value;
+            if (arg == "--io") {
+                if (i >= argc - 1) {
+                    std::cerr << "Error: No value specified for '" << arg << "'.\n";
+                    return std::nullopt;
+                }
+                value = argv[++i];
+            } else {
+                value = arg.substr(5);
+            }
+            auto backend = parse_io_backend(value);
+            if (!backend) {
+                std::cerr << "Error: Unsupported io backend '" << value << "'.\n";
+                return std::nullopt;
+            }
+            opts.io = *backend;
+        } else if (arg == "-c" || arg == "--color-by") {
+            if (i >= argc - 1) {
+                std::cerr << "Error: No value specified for '" << arg << "'.\n";
+                return std::nullopt;
+            }
+            i++;
+            auto mode = parse_color_mode(argv[i]);
+            if (!mode) {
+                std::cerr << "Error: Unsupported color mode '" << argv[i] << "'.\n";
+                return std::nullopt;
+            }
+            opts.color_mode = *mode;
+        } else if (arg == "--tar") {
+            opts.tar = true;
+        } else if (arg == "--edge-list") {
+            opts.edge_list = true;
+        } else if (arg == "--dims") {
+            if (i >= argc - 1) {
+                std::cerr << "Error: No value specified for '" << arg << "'.\n";
+                return std::nullopt;
+            }
+            opts.dims = parse_dims_argument(argv[++i]);
+            if (!opts.dims) {
+                return std::nullopt;
+            }
+        } else if (arg == "--no-cache") {
+            opts.no_cache = true;
+        } else if (arg == "-p" || arg == "--pipeline") {
+            opts.pipeline = true;
+        } else if (arg == "-t" || arg == "--threads") {
+            if (i >= argc - 1) {
+                std::cerr << "Error: No value specified for '" << arg << "'.\n";
+                return std::nullopt;
+            }
+            i++;
+            auto threads = parse_integer_argument(argv[i - 1], argv[i]);
+            if (!threads) {
+                return std::nullopt;
+            }
+            if (*threads == 0) {
+                std::cerr << "Error: The number of threads has to be at least 1.\n";
+                return std::nullopt;
+            }
+            opts.threads = *threads;
         } else {
             if (opts.input_filename) {
                 std::cout << "Error: Multiple input files specified: '" << *opts.input_filename << "' and '" << arg << "'.\n";
@@ -155,5 +391,45 @@ std::optional<CmdOptions> parse_args(int argc, char** argv) {
         }
     }
 
+    if (opts.input_filename) {
+        const std::string& name = *opts.input_filename;
+        if (ends_with(name, ".tar") || ends_with(name, ".tar.gz") || ends_with(name, ".tgz")) {
+            opts.tar = true;
+        }
+
+        std::string plain = ends_with(name, ".gz") ? name.substr(0, name.size() - 3) : name;
+        if (ends_with(plain, ".el") || ends_with(plain, ".wel") || ends_with(plain, ".edges")) {
+            opts.edge_list = true;
+        }
+    }
+
+    return opts;
+}
+
+std::optional<ConvertOptions> parse_convert_args(int argc, char** argv) {
+    ConvertOptions opts;
+    std::vector<std::string> files;
+
+    for (int i = 2; i < argc; ++i) {
+        std::string_view arg(argv[i]);
+        if (arg == "-h" || arg == "--help") {
+            std::cout << "Usage: " << argv[0] << " convert <input_file.mtx> <output_file.mbin>\n";
+            std::cout << convert_help;
+            return std::nullopt;
+        } else if (arg == "-v" || arg == "--verbose") {
+            opts.verbose = true;
+        } else {
+            files.emplace_back(arg);
+        }
+    }
+
+    if (files.size() != 2) {
+        std::cerr << "Error: The convert command needs an input and an output file.\n";
+        return std::nullopt;
+    }
+
+    opts.input_filename = files[0];
+    opts.output_filename = files[1];
+
     return opts;
 }
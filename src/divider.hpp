@@ -0,0 +1,91 @@
+#pragma once
+
+#include <cstdint>
+#include <type_traits>
+
+
+/**
+ * Division by a constant without the division instruction, with the magic
+ * numbers of libdivide.
+ *
+ * Powers of two are divided by a shift. Other divisors use a 64-bit
+ * multiply-high and a shift, with a correcting add for the divisors whose
+ * magic number would need 65 bits. Which of the three it is gets decided
+ * once, so hot loops can be compiled for each of them, see `visit`.
+ */
+struct Divider {
+
+    enum class Kind { shift, multiply, multiply_add };
+
+    template<Kind K>
+    using KindConstant = std::integral_constant<Kind, K>;
+
+    explicit Divider(uint64_t d) {
+        unsigned floor_log2 = 63 - __builtin_clzll(d);
+
+        if ((d & (d - 1)) == 0) {
+            kind_ = Kind::shift;
+            shift_ = floor_log2;
+            return;
+        }
+
+        // 2^(64 + floor_log2) / d, which fits into 64 bits since d isn't a power of two
+        unsigned __int128 power = (unsigned __int128)1 << (64 + floor_log2);
+        uint64_t magic = uint64_t(power / d);
+        uint64_t rem = uint64_t(power % d);
+
+        if (d - rem < (uint64_t(1) << floor_log2)) {
+            kind_ = Kind::multiply;
+        } else {
+            // one more bit of precision, the 65th bit of the magic is added back by multiply_add
+            magic += magic;
+            uint64_t twice_rem = rem + rem;
+            if (twice_rem >= d || twice_rem < rem) {
+                magic += 1;
+            }
+            kind_ = Kind::multiply_add;
+        }
+
+        magic_ = magic + 1;
+        shift_ = floor_log2;
+    }
+
+    Kind kind() const {
+        return kind_;
+    }
+
+    template<Kind K>
+    uint64_t divide(uint64_t n) const {
+        if constexpr (K == Kind::shift) {
+            return n >> shift_;
+        } else {
+            uint64_t q = uint64_t(((unsigned __int128)magic_ * n) >> 64);
+            if constexpr (K == Kind::multiply) {
+                return q >> shift_;
+            } else {
+                return (((n - q) >> 1) + q) >> shift_;
+            }
+        }
+    }
+
+    /**
+     * Calls `f` with the kind of the divider as a `KindConstant`,
+     * which can be passed on as the template argument of `divide`.
+     */
+    template<typename F>
+    decltype(auto) visit(F&& f) const {
+        switch (kind_) {
+            case Kind::shift:
+                return f(KindConstant<Kind::shift>());
+            case Kind::multiply:
+                return f(KindConstant<Kind::multiply>());
+            default:
+                return f(KindConstant<Kind::multiply_add>());
+        }
+    }
+
+private:
+    Kind kind_;
+    uint64_t magic_ = 0;
+    unsigned shift_;
+};
@@ -1,6 +1,7 @@
 #pragma once
 
 #include "../grid.hpp"
+#include "../value_grid.hpp"
 #include "../types.hpp"
 
 #include <string>
@@ -76,6 +77,16 @@ private:
     std::vector<Rgb> colors;
 };
 
+/**
+ * What the color of a block stands for.
+ */
+enum class ColorMode {
+    count,      // number of entries
+    sum,        // sum of their absolute values
+    max,        // largest absolute value
+    nonzeros    // number of entries which aren't explicit zeros
+};
+
 enum class ImageFormat {
     svg,
     png,
@@ -101,6 +112,8 @@ struct ImageConfig {
 
     bool adjust_colors = false;
 
+    ColorMode color_mode = ColorMode::count;
+
     ImageFormat format;
 };
 
@@ -109,6 +122,8 @@ struct ImageDrawer {
 
     virtual void operator()(const Grid& grid, const ImageConfig& config) = 0;
 
+    virtual void operator()(const ValueGrid& grid, const ImageConfig& config) = 0;
+
     virtual ~ImageDrawer() = default;
 
 };
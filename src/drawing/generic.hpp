@@ -2,19 +2,56 @@
 
 #include <drawing/draw.hpp>
 
+#include <algorithm>
+
 template<typename Image>
 struct GenericDrawer : ImageDrawer {
 
     void operator()(const Grid& grid, const ImageConfig& config) override {
+        size_t max_occupancy = config.adjust_colors ? grid.max_occupancy() : grid.block_capacity();
+        draw(grid, config, [&](size_t row, size_t col) {
+            return grid.count_at(row, col)/(float)max_occupancy;
+        });
+    }
+
+    /**
+     * Colors the blocks by the statistic of their values given by the color
+     * mode, relative to the largest one in the grid.
+     */
+    void operator()(const ValueGrid& grid, const ImageConfig& config) override {
+        switch (config.color_mode) {
+            case ColorMode::count:
+                return (*this)(static_cast<const Grid&>(grid), config);
+            case ColorMode::sum: {
+                double max = grid.max_abs_sum();
+                return draw(grid, config, [&](size_t row, size_t col) { return float(grid.abs_sum_at(row, col)/max); });
+            }
+            case ColorMode::max: {
+                double max = grid.max_abs_max();
+                return draw(grid, config, [&](size_t row, size_t col) { return float(grid.abs_max_at(row, col)/max); });
+            }
+            case ColorMode::nonzeros: {
+                size_t max = grid.max_nonzeros();
+                return draw(grid, config, [&](size_t row, size_t col) { return grid.nonzeros_at(row, col)/(float)max; });
+            }
+        }
+    }
+
+private:
+    /**
+     * Draws the image with the blocks colored by `density(row, col)`,
+     * a value between 0 and 1.
+     */
+    template<typename Density>
+    void draw(const Grid& grid, const ImageConfig& config, Density density) {
         Image image(config.width, config.height, { 255, 255, 255 });
 
         draw_borders(image, config);
-        draw_grid(image, config, grid);
+        draw_grid(image, config, grid, density);
 
         image.save(config.path, config.format);
     }
 
-private:
     void draw_borders(Image& image, const ImageConfig& config) {
         Rgb border_color = { 0, 0, 0 };
 
@@ -28,28 +65,27 @@ private:
         image.draw_rectangle({ w - b, 0, b, h }, border_color);
     }
 
-    void draw_grid(Image& image, const ImageConfig& config, const Grid& grid) {
-        Rgb color;
-        Rect block_rect = { 0, config.border_size, config.block_size, config.block_size };
-
-        size_t max_occupancy = config.adjust_colors ? grid.max_occupancy() : grid.block_capacity();
+    template<typename Density>
+    void draw_grid(Image& image, const ImageConfig& config, const Grid& grid, Density density) {
+        Rect block_rect = { 0, 0, config.block_size, config.block_size };
 
-        for (size_t row = 0; row < grid.rows(); ++row) {
-            block_rect.x = config.border_size;
-            for (size_t col = 0; col < grid.cols(); ++col) {
-                if (grid.count_at(row, col) == 0) {
-                    block_rect.x += config.block_size;
-                    continue;
-                }
-                float density = grid.count_at(row, col)/(float)max_occupancy;
-                color = config.color_palette.sample_color(density);
-
-                image.draw_rectangle(block_rect, color);
+        // only visits the allocated parts of tiled grids
+        grid.for_each_block([&](size_t row, size_t col) {
+            if (grid.count_at(row, col) == 0) {
+                return;
+            }
 
-                block_rect.x += config.block_size;
+            // blocks of zeros are left out, and so are NaNs
+            float val = density(row, col);
+            if (!(val > 0)) {
+                return;
             }
-            block_rect.y += config.block_size;
-        }
+            Rgb color = config.color_palette.sample_color(std::min(val, 1.0f));
+
+            block_rect.x = config.border_size + col*config.block_size;
+            block_rect.y = config.border_size + row*config.block_size;
+            image.draw_rectangle(block_rect, color);
+        });
     }
 
 };
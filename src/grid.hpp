@@ -1,29 +1,327 @@
 #pragma once
 
+#include "divider.hpp"
 #include "types.hpp"
 #include "utils.hpp"
 
+#include <algorithm>
+#include <cstdint>
+#include <limits>
+#include <type_traits>
+#include <unordered_map>
+#include <utility>
 #include <vector>
 
 
+/**
+ * Number of entries in each block of the matrix.
+ *
+ * The counts are kept in 16-bit counters, which keeps even poster-sized
+ * grids and the per-thread copies of parallel runs small and cache friendly.
+ * Whenever a counter wraps around, the lost 2^16 goes into a side table,
+ * so only the rare crowded blocks pay for a wider count.
+ *
+ * Grids with more than `max_dense_blocks` blocks are split into square
+ * tiles which are allocated only once an entry lands in them, so huge
+ * grids of mostly empty matrices take memory only for the touched parts.
+ * Blocks are stored row by row, in the tiles too. Splitting smaller grids
+ * into the tiles as well, as compared by `tests/grid_bench.cpp`, is faster
+ * only for input sorted by columns, and slower for random, row-sorted and
+ * band input. Drawing skips the tiles without entries, but that saves only
+ * milliseconds next to writing the image.
+ *
+ * Grids too large for the cache hold back the entries added one by one
+ * and add them in batches partitioned by the part of the grid they fall
+ * into, which turns the cache misses of unordered input into cache hits.
+ * Entries which are clustered already, like sorted ones or those of
+ * a block of the matrix, are added directly. That is judged for every
+ * batch by a window of its entries, so the grid switches whenever the
+ * input changes. The held back entries are added by `flush`, which has
+ * to be called before the counts are read. `tests/grid_bench.cpp`
+ * compares both ways.
+ *
+ * Indices are mapped to blocks by a `Divider` picked for the block size,
+ * and the loops adding entries are compiled for each kind of it.
+ * With `pow2_blocks` the block size is rounded up to a power of two,
+ * so that the mapping is a plain shift.
+ *
+ * Symmetric, skew-symmetric and hermitian matrices keep only the lower
+ * triangle of blocks, where each entry is counted together with its
+ * mirror. The upper triangle is read from the lower one. Whether the grid
+ * is triangular is a template parameter of the paths adding entries,
+ * so general matrices don't check it for every entry.
+ */
 struct Grid {
 
-    Grid(const Header& header, size_t max_grid_rows, size_t max_grid_cols)
-        : block_size_( get_block_size(header.rows, header.cols, max_grid_rows, max_grid_cols) ),
+    using Counter = uint16_t;
+
+    static constexpr size_t max_dense_blocks = size_t(1) << 24;
+
+    static constexpr size_t tile_shift = 6;
+    static constexpr size_t tile_side = size_t(1) << tile_shift;
+    static constexpr size_t tile_size = tile_side*tile_side;
+
+    static constexpr size_t min_batched_blocks = size_t(1) << 22;
+    static constexpr size_t batch_size = size_t(1) << 21;
+
+    // entries whose blocks `on_entries` computes before counting them
+    static constexpr size_t entries_run = 1024;
+
+    /**
+     * With `tiles` the grid is split into tiles even if it is small enough
+     * to be dense, which is there to compare both layouts.
+     */
+    Grid(const Header& header, size_t max_grid_rows, size_t max_grid_cols, bool pow2_blocks = false, bool tiles = false)
+        : block_size_( get_block_size(header.rows, header.cols, max_grid_rows, max_grid_cols, pow2_blocks) ),
+          block_divider_(block_size_),
           grid_rows_( div_ceil(header.rows, block_size_) ),
           grid_cols_( div_ceil(header.cols, block_size_) ),
-          data_( grid_rows_*grid_cols_, 0 ),
-          matrix_symmetry_(header.symmetry) { }
+          tiled_( tiles || grid_rows_*grid_cols_ > max_dense_blocks ),
+          symmetric_(header.symmetry != Symmetry::general)
+    {
+        if (tiled_) {
+            tile_cols_ = div_ceil(grid_cols_, tile_side);
+            tiles_.resize(div_ceil(grid_rows_, tile_side)*tile_cols_, no_tile);
+        } else {
+            data_.resize(grid_rows_*grid_cols_, 0);
+        }
+
+        batched_ = worth_batching();
+        reset_clustered();
+    }
 
     void on_entry(size_t row, size_t col) {
-        add_entry(row, col);
-        if (matrix_symmetry_ != Symmetry::general && row != col) {
-            add_entry(col, row);
+        visit_layout([&](auto kind, auto symmetric) {
+            add_entry<kind, symmetric>(row, col);
+        });
+    }
+
+    /**
+     * Adds the entries of one matrix row given by their column indices.
+     *
+     * All of them fall into the same row of blocks, so it is looked up once.
+     */
+    template<typename Index>
+    void on_row(size_t row, const Index* cols, size_t count) {
+        if (symmetric_ || tiled_) {
+            for (size_t i = 0; i < count; ++i) {
+                on_entry(row, cols[i]);
+            }
+            return;
+        }
+
+        block_divider_.visit([&](auto kind) {
+            size_t first = index(block_divider_.divide<kind>(row), 0);
+            for (size_t i = 0; i < count; ++i) {
+                increment(first + block_divider_.divide<kind>(cols[i]));
+            }
+        });
+        entries_count_ += count;
+    }
+
+    /**
+     * Adds the entries of one matrix column given by their row indices.
+     */
+    template<typename Index>
+    void on_col(size_t col, const Index* rows, size_t count) {
+        if (symmetric_ || tiled_) {
+            for (size_t i = 0; i < count; ++i) {
+                on_entry(rows[i], col);
+            }
+            return;
+        }
+
+        block_divider_.visit([&](auto kind) {
+            size_t first = index(0, block_divider_.divide<kind>(col));
+            for (size_t i = 0; i < count; ++i) {
+                increment(first + block_divider_.divide<kind>(rows[i])*grid_cols_);
+            }
+        });
+        entries_count_ += count;
+    }
+
+    /**
+     * Adds a batch of entries given by arrays of their row and column indices.
+     *
+     * The blocks of a run of entries are computed in one loop and only then
+     * counted in another, so the division loop stays free of the memory
+     * accesses and can be vectorized when the divider is a shift.
+     * The counting loop has no dependencies between the increments, so their
+     * cache misses overlap and dense grids add the runs directly, which is
+     * as fast as holding them back for `flush` even for random input.
+     */
+    template<typename RowIndex, typename ColIndex>
+    void on_entries(const RowIndex* rows, const ColIndex* cols, size_t count) {
+        if (symmetric_ || tiled_) {
+            visit_layout([&](auto kind, auto symmetric) {
+                for (size_t i = 0; i < count; ++i) {
+                    add_entry<kind, symmetric>(rows[i], cols[i]);
+                }
+            });
+            return;
+        }
+
+        block_divider_.visit([&](auto kind) {
+            // a dense grid has less than 2^32 counters
+            uint32_t positions[entries_run];
+            for (size_t first = 0; first < count; first += entries_run) {
+                size_t n = std::min(entries_run, count - first);
+                for (size_t i = 0; i < n; ++i) {
+                    size_t block_row = block_divider_.divide<kind>(rows[first + i]);
+                    size_t block_col = block_divider_.divide<kind>(cols[first + i]);
+                    positions[i] = uint32_t(block_row*grid_cols_ + block_col);
+                }
+
+                for (size_t i = 0; i < n; ++i) {
+                    increment(positions[i]);
+                }
+            }
+        });
+        entries_count_ += count;
+    }
+
+    void clear() {
+        if (tiled_) {
+            data_.clear();
+            std::fill(tiles_.begin(), tiles_.end(), no_tile);
+            tile_owners_.clear();
+        } else {
+            std::fill(data_.begin(), data_.end(), 0);
+        }
+        carries_.clear();
+        pending_.clear();
+        batched_ = worth_batching();
+        reset_clustered();
+        entries_count_ = 0;
+    }
+
+    /**
+     * Overrides whether the entries are held back for `flush`, which is
+     * otherwise picked by the size of the grid, until `clear`. Grids with
+     * more than 2^32 counters never hold them back.
+     */
+    void set_batched(bool batched) {
+        flush();
+        batched_ = batched && max_counters() <= std::numeric_limits<uint32_t>::max();
+        reset_clustered();
+    }
+
+    /**
+     * Adds the entries held back by `on_entry`.
+     *
+     * They are partitioned by the ranges of counters small enough to stay
+     * in L2 with a counting sort, so the increments of each range hit
+     * the cache. Batches whose first window of entries is clustered, like
+     * those from sorted input, are added as they are, and so are the next
+     * entries until a window isn't.
+     */
+    void flush() {
+        if (pending_.empty()) {
+            return;
+        }
+
+        size_t sample = std::min(pending_.size(), clustered_window);
+        for (size_t k = 0; k < sample; ++k) {
+            mark_line(pending_[k]);
+        }
+        if (window_clustered()) {
+            for (uint32_t i : pending_) {
+                increment(i);
+            }
+            pending_.clear();
+            holding_back_ = false;
+            clustered_entries_ = 0;
+            return;
+        }
+
+        size_t partitions = (data_.size() >> partition_shift) + 1;
+        partition_starts_.assign(partitions + 1, 0);
+        for (uint32_t i : pending_) {
+            partition_starts_[(i >> partition_shift) + 1]++;
+        }
+
+        for (size_t p = 1; p <= partitions; ++p) {
+            partition_starts_[p] += partition_starts_[p - 1];
+        }
+
+        partitioned_.resize(pending_.size());
+        for (uint32_t i : pending_) {
+            partitioned_[partition_starts_[i >> partition_shift]++] = i;
+        }
+
+        for (uint32_t i : partitioned_) {
+            increment(i);
         }
+        pending_.clear();
+    }
+
+    /**
+     * Adds the counts of `other` into this grid.
+     *
+     * Both grids have to be created for the same matrix and size.
+     */
+    void merge(const Grid& other) {
+        flush();
+
+        for_each_shared_range(other, [&](size_t first, size_t other_first, size_t n) {
+            Counter* __restrict dst = data_.data() + first;
+            const Counter* __restrict src = other.data_.data() + other_first;
+
+            for (size_t i = 0; i < n; ++i) {
+                Counter sum = dst[i] + src[i];
+                if (sum < dst[i]) {
+                    carries_[first + i] += counter_range;
+                }
+                dst[i] = sum;
+            }
+        });
+
+        for (auto [i, carry] : other.carries_) {
+            carries_[translate(other, i)] += carry;
+        }
+
+        for (uint32_t i : other.pending_) {
+            hold_back(translate(other, i));
+        }
+        flush();
+
+        entries_count_ += other.entries_count_;
     }
 
     size_t count_at(size_t row, size_t col) const {
-        return at(row, col);
+        size_t i = find(row, col);
+        return i == npos ? 0 : count(i);
+    }
+
+    /**
+     * Calls `f(row, col)` for every block which may hold some entries,
+     * row by row. That is every block of a dense grid, and the blocks
+     * of the allocated tiles of a tiled one, or of their mirrors.
+     */
+    template<typename F>
+    void for_each_block(F&& f) const {
+        if (!tiled_) {
+            for (size_t row = 0; row < grid_rows_; ++row) {
+                for (size_t col = 0; col < grid_cols_; ++col) {
+                    f(row, col);
+                }
+            }
+            return;
+        }
+
+        for (size_t row = 0; row < grid_rows_; ++row) {
+            size_t tile_row = row >> tile_shift;
+            for (size_t t = 0; t < tile_cols_; ++t) {
+                if (tiles_[tile_row*tile_cols_ + t] == no_tile
+                        && !(symmetric_ && tiles_[t*tile_cols_ + tile_row] != no_tile)) {
+                    continue;
+                }
+                size_t last_col = std::min(grid_cols_, (t + 1)*tile_side);
+                for (size_t col = t*tile_side; col < last_col; ++col) {
+                    f(row, col);
+                }
+            }
+        }
     }
 
     size_t block_capacity() const {
@@ -46,6 +344,17 @@ struct Grid {
         return entries_count_;
     }
 
+    bool tiled() const {
+        return tiled_;
+    }
+
+    /**
+     * Number of blocks which have a counter, all of them in a dense grid.
+     */
+    size_t allocated_blocks() const {
+        return data_.size();
+    }
+
     size_t max_occupancy() const {
         size_t res = 0;
         for (auto x : data_) {
@@ -53,48 +362,287 @@ struct Grid {
                 res = x;
             }
         }
+        for (auto [i, carry] : carries_) {
+            res = std::max(res, count(i));
+        }
         return res;
     }
 
-private:
+protected:
+    static constexpr size_t counter_range = size_t(std::numeric_limits<Counter>::max()) + 1;
+    static constexpr size_t npos = size_t(-1);
+    static constexpr uint32_t no_tile = std::numeric_limits<uint32_t>::max();
+    static constexpr size_t tile_mask = tile_side - 1;
+
+    // 128 KB of counters
+    static constexpr size_t partition_shift = 16;
+
+    // entries added directly before deciding whether to hold them back
+    static constexpr size_t clustered_window = size_t(1) << 16;
+    // counters in a cache line, and the lines of a window still added directly, 512 KB
+    static constexpr size_t line_shift = 5;
+    static constexpr size_t cached_lines = size_t(1) << 13;
+    static constexpr size_t window_bits_shift = 16;
+
+    /**
+     * Position of the counter of the block in `data_`,
+     * allocating its tile if there isn't one yet.
+     */
+    size_t index(size_t row, size_t col) {
+        if (!tiled_) {
+            return row*grid_cols_ + col;
+        }
+        return tile_offset((row >> tile_shift)*tile_cols_ + (col >> tile_shift))
+             + ((row & tile_mask) << tile_shift) + (col & tile_mask);
+    }
+
+    /**
+     * Position of the counter of the block in `data_`, or of its mirror
+     * in triangular grids, or npos if its tile isn't allocated.
+     */
+    size_t find(size_t row, size_t col) const {
+        if (symmetric_ && col > row) {
+            std::swap(row, col);
+        }
+        if (!tiled_) {
+            return row*grid_cols_ + col;
+        }
+        uint32_t tile = tiles_[(row >> tile_shift)*tile_cols_ + (col >> tile_shift)];
+        if (tile == no_tile) {
+            return npos;
+        }
+        return size_t(tile)*tile_size + ((row & tile_mask) << tile_shift) + (col & tile_mask);
+    }
+
+    /**
+     * Position in `data_` of the `t`-th tile of the directory.
+     */
+    size_t tile_offset(size_t t) {
+        uint32_t& tile = tiles_[t];
+        if (tile == no_tile) {
+            tile = tile_owners_.size();
+            tile_owners_.push_back(t);
+            data_.resize(data_.size() + tile_size, 0);
+        }
+        return size_t(tile)*tile_size;
+    }
+
+    /**
+     * Calls `f(first, other_first, n)` for the ranges of counters of this
+     * grid and `other` which belong to the same blocks, allocating tiles
+     * for all those allocated in `other`.
+     */
+    template<typename F>
+    void for_each_shared_range(const Grid& other, F&& f) {
+        if (!tiled_) {
+            f(0, 0, data_.size());
+            return;
+        }
+        for (size_t other_tile = 0; other_tile < other.tile_owners_.size(); ++other_tile) {
+            f(tile_offset(other.tile_owners_[other_tile]), other_tile*tile_size, tile_size);
+        }
+    }
+
+    /**
+     * Position in this grid of the counter at position `i` of `other`.
+     */
+    size_t translate(const Grid& other, size_t i) {
+        if (!tiled_) {
+            return i;
+        }
+        return tile_offset(other.tile_owners_[i/tile_size]) + i%tile_size;
+    }
+
+    size_t count(size_t i) const {
+        if (carries_.empty()) {
+            return data_[i];
+        }
+        auto it = carries_.find(i);
+        return data_[i] + (it == carries_.end() ? 0 : it->second);
+    }
+
+    void increment(size_t i) {
+        if (++data_[i] == 0) {
+            carries_[i] += counter_range;
+        }
+    }
+
+    void hold_back(size_t i) {
+        pending_.push_back(i);
+        if (pending_.size() == batch_size) {
+            flush();
+        }
+    }
+
+    /**
+     * Calls `f(kind, symmetric)` with the kind of the block divider and
+     * whether the grid is triangular, both as compile-time constants.
+     */
+    template<typename F>
+    void visit_layout(F&& f) const {
+        block_divider_.visit([&](auto kind) {
+            if (symmetric_) {
+                f(kind, std::true_type());
+            } else {
+                f(kind, std::false_type());
+            }
+        });
+    }
+
+    size_t max_counters() const {
+        return tiled_ ? tiles_.size()*tile_size : data_.size();
+    }
+
+    bool worth_batching() const {
+        // the held back entries are 32-bit positions in data_
+        return max_counters() >= min_batched_blocks && max_counters() <= std::numeric_limits<uint32_t>::max();
+    }
 
-    const size_t& at(size_t row, size_t col) const {
-        return data_[row*grid_cols_ + col];
+    void add(size_t i) {
+        if (!batched_) {
+            increment(i);
+        } else if (holding_back_) {
+            hold_back(i);
+        } else {
+            add_clustered(i);
+        }
     }
 
-    size_t& at(size_t row, size_t col) {
-        return const_cast<size_t&>(static_cast<const Grid&>(*this).at(row, col));
+    /**
+     * Adds an entry directly, at first and after a clustered batch.
+     * The first window of entries of every batch is watched by marking
+     * their cache lines, and once it isn't clustered the entries are
+     * held back again.
+     */
+    void add_clustered(size_t i) {
+        increment(i);
+        size_t k = clustered_entries_++;
+        if (k < clustered_window) {
+            mark_line(i);
+            if (k + 1 == clustered_window) {
+                holding_back_ = !window_clustered();
+            }
+        } else if (clustered_entries_ == batch_size) {
+            clustered_entries_ = 0;
+        }
     }
 
+    /**
+     * Marks the cache line of the counter `i` in a hashed bitmap with eight
+     * bits for each of the `cached_lines`, so that up to that many lines
+     * hardly collide, and counts how often the partition changes.
+     */
+    void mark_line(size_t i) {
+        uint32_t partition = i >> partition_shift;
+        window_switches_ += partition != last_partition_;
+        last_partition_ = partition;
+
+        uint32_t hash = uint32_t(i >> line_shift)*0x9e3779b1u >> (32 - window_bits_shift);
+        window_lines_[hash >> 6] |= uint64_t(1) << (hash & 63);
+    }
+
+    /**
+     * Whether the entries marked since the last call are added faster
+     * directly, because they sweep through the partitions in order or
+     * their cache lines fit in the cache. Clears the marks.
+     */
+    bool window_clustered() {
+        size_t lines = 0;
+        for (uint64_t& word : window_lines_) {
+            lines += __builtin_popcountll(word);
+            word = 0;
+        }
+        size_t switches = std::exchange(window_switches_, 0);
+        return switches < clustered_window/8 || lines <= cached_lines;
+    }
+
+    void reset_clustered() {
+        holding_back_ = false;
+        clustered_entries_ = 0;
+        window_switches_ = 0;
+        last_partition_ = 0;
+        window_lines_.assign((size_t(1) << window_bits_shift)/64, 0);
+    }
+
+    template<Divider::Kind K, bool Symmetric>
     void add_entry(size_t row, size_t col) {
-        at(row/block_size_, col/block_size_)++;
+        size_t block_row = block_divider_.divide<K>(row);
+        size_t block_col = block_divider_.divide<K>(col);
+
+        if constexpr (Symmetric) {
+            size_t i = index(std::max(block_row, block_col), std::min(block_row, block_col));
+            add(i);
+            if (row != col) {
+                // the mirror falls into the same counter, unless it is a diagonal block
+                if (block_row == block_col) {
+                    add(i);
+                }
+                entries_count_++;
+            }
+        } else {
+            add(index(block_row, block_col));
+        }
         entries_count_++;
     }
 
     size_t get_block_size(size_t matrix_rows,
                           size_t matrix_cols,
                           size_t max_grid_rows,
-                          size_t max_grid_cols) const 
+                          size_t max_grid_cols,
+                          bool pow2_blocks) const
     {
         size_t block_height = get_bin_size(matrix_rows, max_grid_rows);
         size_t block_width = get_bin_size(matrix_cols, max_grid_cols);
 
-        return block_height >= block_width ? block_height : block_width;
+        size_t block_size = block_height >= block_width ? block_height : block_width;
+        if (pow2_blocks) {
+            while (block_size & (block_size - 1)) {
+                block_size += block_size & -block_size;
+            }
+        }
+        return block_size;
     }
 
     size_t get_bin_size(size_t num_values, size_t max_bins) const {
         return num_values <= max_bins ? 1 : div_ceil(num_values, max_bins);
     }
 
-private:
+protected:
     size_t block_size_;
+    Divider block_divider_;
 
     size_t grid_rows_;
     size_t grid_cols_;
 
-    std::vector<size_t> data_;
+    bool tiled_;
+
+    // counters of all the blocks, or of the allocated tiles one after another
+    std::vector<Counter> data_;
+
+    // multiples of the counter range lost by the counters which wrapped around
+    std::unordered_map<size_t, size_t> carries_;
+
+    // directory of the tiles, with their positions in data_ in tile_size units
+    size_t tile_cols_ = 0;
+    std::vector<uint32_t> tiles_;
+    // and the directory slot of each allocated tile
+    std::vector<size_t> tile_owners_;
+
+    bool batched_;
+    std::vector<uint32_t> pending_;
+    // false while the entries look clustered and are added directly
+    bool holding_back_ = false;
+    size_t clustered_entries_ = 0;
+    // hashed bitmap of the cache lines hit by the current window
+    std::vector<uint64_t> window_lines_;
+    size_t window_switches_ = 0;
+    uint32_t last_partition_ = 0;
+    // scratch space of flush
+    std::vector<uint32_t> partition_starts_;
+    std::vector<uint32_t> partitioned_;
 
     size_t entries_count_ = 0;
 
-    Symmetry matrix_symmetry_;
+    // only the lower triangle of blocks is stored
+    bool symmetric_;
 };
@@ -0,0 +1,48 @@
+#pragma once
+
+#include <cstdlib>
+#include <memory>
+#include <new>
+
+
+/**
+ * Heap buffer whose start is aligned to `alignment` bytes,
+ * as required e.g. for direct I/O.
+ */
+struct AlignedBuffer {
+
+    AlignedBuffer(size_t size, size_t alignment = 4096)
+        : data_(static_cast<char*>(std::aligned_alloc(alignment, round_up(size, alignment)))),
+          size_(size)
+    {
+        if (!data_) {
+            throw std::bad_alloc();
+        }
+    }
+
+    char* data() {
+        return data_.get();
+    }
+
+    const char* data() const {
+        return data_.get();
+    }
+
+    size_t size() const {
+        return size_;
+    }
+
+private:
+    static size_t round_up(size_t size, size_t alignment) {
+        return (size + alignment - 1)/alignment*alignment;
+    }
+
+    struct Free {
+        void operator()(char* ptr) const {
+            std::free(ptr);
+        }
+    };
+
+    std::unique_ptr<char[], Free> data_;
+    size_t size_;
+};
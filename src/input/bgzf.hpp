@@ -0,0 +1,394 @@
+#pragma once
+
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "source.hpp"
+#include "mapped_file.hpp"
+#include "inflate.hpp"
+#include "gzip.hpp"
+
+#include <algorithm>
+#include <condition_variable>
+#include <cstdint>
+#include <cstring>
+#include <exception>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+
+/**
+ * Position of one gzip member in a file made of several members.
+ */
+struct GzipMember {
+    size_t offset;             // in the compressed file
+    size_t size;               // compressed size including the header and trailer
+    size_t uncompressed_size;
+};
+
+
+uint32_t read_le32(const char* data) {
+    const unsigned char* p = reinterpret_cast<const unsigned char*>(data);
+    return uint32_t(p[0]) | uint32_t(p[1]) << 8 | uint32_t(p[2]) << 16 | uint32_t(p[3]) << 24;
+}
+
+uint64_t read_le64(const char* data) {
+    return uint64_t(read_le32(data)) | uint64_t(read_le32(data + 4)) << 32;
+}
+
+/**
+ * Returns the total size of the BGZF block starting at `data`,
+ * or 0 if there isn't a BGZF block header.
+ *
+ * BGZF blocks are gzip members with a 'BC' extra field holding the size
+ * of the whole member, so the members can be found without decompressing.
+ */
+size_t bgzf_block_size(const char* data, size_t size) {
+    // the fixed part of the header and the length of the extra field
+    constexpr size_t fixed_size = 12;
+
+    if (size < fixed_size || !has_gzip_magic(std::string_view(data, size))
+            || data[2] != 8 || !(data[3] & gzip_flag_extra)) {
+        return 0;
+    }
+
+    size_t extra_size = uint8_t(data[10]) | uint8_t(data[11]) << 8;
+    if (size < fixed_size + extra_size) {
+        return 0;
+    }
+
+    const char* field = data + fixed_size;
+    const char* extra_end = field + extra_size;
+    while (extra_end - field >= 4) {
+        size_t field_size = uint8_t(field[2]) | uint8_t(field[3]) << 8;
+        if (field[0] == 'B' && field[1] == 'C' && field_size == 2 && extra_end - field >= 6) {
+            return (uint8_t(field[4]) | uint8_t(field[5]) << 8) + 1;
+        }
+        field += 4 + field_size;
+    }
+
+    return 0;
+}
+
+/**
+ * Lists the blocks of a BGZF file.
+ * Returns nullopt if the data isn't a well-formed BGZF file.
+ */
+std::optional<std::vector<GzipMember>> scan_bgzf_blocks(const char* data, size_t size) {
+    // the smallest possible trailer
+    constexpr size_t trailer_size = 8;
+
+    std::vector<GzipMember> blocks;
+    size_t offset = 0;
+
+    while (offset < size) {
+        size_t block_size = bgzf_block_size(data + offset, size - offset);
+        if (block_size < trailer_size || block_size > size - offset) {
+            return std::nullopt;
+        }
+
+        size_t uncompressed_size = read_le32(data + offset + block_size - 4);
+        blocks.push_back({ offset, block_size, uncompressed_size });
+        offset += block_size;
+    }
+
+    return blocks;
+}
+
+/**
+ * Reads a `.gzi` index, as written by `bgzip --index`, of a file made of
+ * gzip members with total compressed size `file_size`.
+ *
+ * The index is a little-endian 64-bit count followed by pairs of compressed
+ * and uncompressed offsets of each member but the first. Returns nullopt
+ * if the index doesn't exist or doesn't match the file.
+ */
+std::optional<std::vector<GzipMember>> read_gzi_index(const std::string& path, const char* data, size_t file_size) {
+    std::ifstream file(path, std::ios::binary);
+    if (!file) {
+        return std::nullopt;
+    }
+
+    char buffer[16];
+    if (!file.read(buffer, 8)) {
+        return std::nullopt;
+    }
+    uint64_t count = read_le64(buffer);
+
+    std::vector<GzipMember> members = { { 0, 0, 0 } };
+    for (uint64_t i = 0; i < count; ++i) {
+        if (!file.read(buffer, 16)) {
+            return std::nullopt;
+        }
+        size_t offset = read_le64(buffer);
+        size_t uncompressed_offset = read_le64(buffer + 8);
+
+        // the previous member ends where this one starts
+        GzipMember& prev = members.back();
+        if (offset <= prev.offset || offset >= file_size || uncompressed_offset < prev.uncompressed_size) {
+            return std::nullopt;
+        }
+        prev.size = offset - prev.offset;
+        prev.uncompressed_size = uncompressed_offset - prev.uncompressed_size;
+
+        // temporarily holds the uncompressed offset
+        members.push_back({ offset, 0, uncompressed_offset });
+    }
+
+    GzipMember& last = members.back();
+    last.size = file_size - last.offset;
+    if (last.size < 8) {
+        return std::nullopt;
+    }
+    last.uncompressed_size = read_le32(data + file_size - 4);
+
+    return members;
+}
+
+
+/**
+ * Decompresses a file made of many independent gzip members, such as BGZF,
+ * on several threads.
+ *
+ * The members are grouped into batches of a few megabytes which are
+ * decompressed by a pool of workers into a ring of buffers and handed out
+ * in order. Since the decompressed size of each member is known from its
+ * trailer, every member is inflated straight to its final place
+ * in the batch, with no copy through the window of the inflater.
+ *
+ * When the page cache is to be left alone, the compressed data of each
+ * batch is evicted as soon as it has been decompressed.
+ */
+struct ParallelGzipSource : InputSource {
+
+    static constexpr size_t default_batch_size = 1 << 22;
+
+    /**
+     * Opens the file at `path` if it is BGZF or if it is accompanied
+     * by a `.gzi` index. Otherwise returns nullptr and the file has to be
+     * decompressed sequentially.
+     */
+    static std::unique_ptr<ParallelGzipSource> open(const std::string& path, size_t threads, bool drop_cache = false) {
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0) {
+            return nullptr;
+        }
+
+        auto file = MappedFile::map(fd);
+        if (!file || !drop_cache) {
+            ::close(fd);
+            fd = -1;
+        }
+        if (!file) {
+            return nullptr;
+        }
+
+        std::string kind = "bgzf";
+        auto members = scan_bgzf_blocks(file->data(), file->size());
+        if (!members) {
+            kind = "gzi index";
+            members = read_gzi_index(path + ".gzi", file->data(), file->size());
+        }
+
+        if (!members || members->size() < 2) {
+            if (fd >= 0) {
+                ::close(fd);
+            }
+            return nullptr;
+        }
+
+        return std::make_unique<ParallelGzipSource>(std::move(*file), std::move(*members), threads, kind, fd);
+    }
+
+    /**
+     * Takes over `drop_fd`, the descriptor of the file through which
+     * the decompressed batches are evicted, or -1 to keep them cached.
+     */
+    ParallelGzipSource(MappedFile file, std::vector<GzipMember> members, size_t threads, std::string kind, int drop_fd = -1)
+        : file_(std::move(file)),
+          members_(std::move(members)),
+          kind_(std::move(kind)),
+          drop_fd_(drop_fd)
+    {
+        size_t first = 0;
+        size_t size = 0;
+        for (size_t i = 0; i < members_.size(); ++i) {
+            size += members_[i].uncompressed_size;
+            if (size >= default_batch_size || i + 1 == members_.size()) {
+                batches_.push_back({ first, i + 1, size });
+                first = i + 1;
+                size = 0;
+            }
+        }
+
+        threads = std::max<size_t>(1, threads);
+        slots_.resize(2*threads);
+        for (size_t i = 0; i < threads; ++i) {
+            workers_.emplace_back([this] { work(); });
+        }
+    }
+
+    ~ParallelGzipSource() {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            stopped_ = true;
+        }
+        released_cv_.notify_all();
+        for (auto& worker : workers_) {
+            worker.join();
+        }
+        if (drop_fd_ >= 0) {
+            ::close(drop_fd_);
+        }
+    }
+
+    Chunk next() override {
+        std::unique_lock<std::mutex> lock(mutex_);
+
+        // the slot of the previously returned batch can be reused now
+        if (holding_) {
+            holding_ = false;
+            slots_[released_ % slots_.size()].ready = false;
+            ++released_;
+            released_cv_.notify_all();
+        }
+
+        if (released_ == batches_.size()) {
+            return { nullptr, 0 };
+        }
+
+        Slot& slot = slots_[released_ % slots_.size()];
+        ready_cv_.wait(lock, [&slot] { return slot.ready; });
+
+        if (slot.error) {
+            std::rethrow_exception(slot.error);
+        }
+
+        holding_ = true;
+        return { slot.data.data(), slot.data.size() };
+    }
+
+    std::string name() const override {
+        size_t threads = workers_.size();
+        return std::string(drop_fd_ >= 0 ? "mmap (dropping cache)" : "mmap") + ", gzip, " + kind_ + ", "
+            + std::to_string(threads) + (threads == 1 ? " thread" : " threads");
+    }
+
+private:
+    struct Batch {
+        size_t first_member;
+        size_t end_member;
+        size_t size;
+    };
+
+    struct Slot {
+        std::vector<char> data;
+        bool ready = false;
+        std::exception_ptr error;
+    };
+
+    void work() {
+        Chunk member = { nullptr, 0 };
+        BitReader input([&member] { return std::exchange(member, Chunk{ nullptr, 0 }); });
+        Inflater inflater(input);
+
+        while (true) {
+            size_t index;
+            {
+                std::unique_lock<std::mutex> lock(mutex_);
+                released_cv_.wait(lock, [this] {
+                    return stopped_ || scheduled_ == batches_.size() || scheduled_ < released_ + slots_.size();
+                });
+                if (stopped_ || scheduled_ == batches_.size()) {
+                    return;
+                }
+                index = scheduled_++;
+            }
+
+            Slot& slot = slots_[index % slots_.size()];
+            try {
+                const Batch& batch = batches_[index];
+                slot.data.resize(batch.size);
+
+                char* out = slot.data.data();
+                for (size_t i = batch.first_member; i < batch.end_member; ++i) {
+                    member = { file_.data() + members_[i].offset, members_[i].size };
+                    input.reset();
+                    inflater.reset();
+                    inflate_member(input, inflater, out, members_[i].uncompressed_size);
+                    out += members_[i].uncompressed_size;
+                }
+                drop_batch(batch);
+            } catch (...) {
+                slot.error = std::current_exception();
+            }
+
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                slot.ready = true;
+            }
+            ready_cv_.notify_all();
+        }
+    }
+
+    /**
+     * Evicts the compressed data of `batch` from the page cache if asked to.
+     * Pages still used by a neighboring batch stay until a later batch is done.
+     */
+    void drop_batch(const Batch& batch) const {
+        if (drop_fd_ < 0) {
+            return;
+        }
+
+        size_t page = sysconf(_SC_PAGESIZE);
+        const GzipMember& last = members_[batch.end_member - 1];
+        size_t first = (members_[batch.first_member].offset + page - 1)/page*page;
+        size_t end = (last.offset + last.size)/page*page;
+        if (first >= end) {
+            return;
+        }
+
+        // mapped pages stay in the cache, so they are unmapped from this process first
+        madvise(const_cast<char*>(file_.data()) + first, end - first, MADV_DONTNEED);
+        // Only cached folios lying wholly in the range are evicted, and large folios
+        // straddle the batch boundaries. Everything before the batch is evicted again,
+        // which catches them once the neighboring batches are done as well.
+        posix_fadvise(drop_fd_, 0, end, POSIX_FADV_DONTNEED);
+    }
+
+    static void inflate_member(BitReader& input, Inflater& inflater, char* out, size_t size) {
+        read_gzip_header(input);
+
+        char dummy;
+        if (inflater.read(out, size) != size || inflater.read(&dummy, 1) != 0) {
+            throw std::runtime_error("Corrupted compressed input: length mismatch.");
+        }
+
+        read_gzip_trailer(input, crc32_update(0, out, size), size);
+    }
+
+    MappedFile file_;
+    std::vector<GzipMember> members_;
+    std::string kind_;
+    int drop_fd_;
+    std::vector<Batch> batches_;
+
+    std::vector<Slot> slots_;
+    std::vector<std::thread> workers_;
+
+    std::mutex mutex_;
+    std::condition_variable ready_cv_;
+    std::condition_variable released_cv_;
+
+    size_t scheduled_ = 0;    // batches handed to the workers
+    size_t released_ = 0;     // batches given back by the consumer
+    bool holding_ = false;
+    bool stopped_ = false;
+};
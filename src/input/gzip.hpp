@@ -0,0 +1,248 @@
+#pragma once
+
+#include "reader.hpp"
+#include "inflate.hpp"
+#include "aligned_buffer.hpp"
+
+#include <cstdint>
+#include <fstream>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+
+
+/**
+ * Checks whether `data` starts with the two magic bytes of gzip.
+ */
+bool has_gzip_magic(std::string_view data) {
+    return data.size() >= 2 && uint8_t(data[0]) == 0x1f && uint8_t(data[1]) == 0x8b;
+}
+
+/**
+ * Checks whether the file at `path` looks like gzip, either by its
+ * extension or by its first bytes.
+ */
+bool is_gzip_file(const std::string& path) {
+    if (path.size() > 3 && path.compare(path.size() - 3, 3, ".gz") == 0) {
+        return true;
+    }
+
+    std::ifstream file(path, std::ios::binary);
+    char magic[2];
+    file.read(magic, 2);
+    return has_gzip_magic(std::string_view(magic, file.gcount()));
+}
+
+
+// flags in the member header
+constexpr uint8_t gzip_flag_hcrc = 1 << 1;
+constexpr uint8_t gzip_flag_extra = 1 << 2;
+constexpr uint8_t gzip_flag_name = 1 << 3;
+constexpr uint8_t gzip_flag_comment = 1 << 4;
+constexpr uint8_t gzip_flag_reserved = 0xE0;
+
+/**
+ * Checks whether the next bytes in `in` are the magic bytes of a gzip member.
+ */
+bool at_gzip_member(BitReader& in) {
+    in.refill();
+    return in.peek(16) == 0x8b1f;
+}
+
+void skip_bytes(BitReader& in, size_t count) {
+    for (size_t i = 0; i < count; ++i) {
+        in.byte();
+    }
+}
+
+/**
+ * Reads the header of a gzip member, so the compressed data follows.
+ * Throws std::runtime_error if it isn't a valid header.
+ */
+void read_gzip_header(BitReader& in) {
+    if (!at_gzip_member(in)) {
+        throw std::runtime_error("The input is not in the gzip format.");
+    }
+    skip_bytes(in, 2);
+
+    if (in.byte() != 8) {
+        throw std::runtime_error("Unsupported gzip compression method.");
+    }
+
+    uint8_t flags = in.byte();
+    if (flags & gzip_flag_reserved) {
+        throw std::runtime_error("Unsupported gzip header flags.");
+    }
+
+    // modification time, extra flags and operating system
+    skip_bytes(in, 6);
+
+    if (flags & gzip_flag_extra) {
+        unsigned length = in.byte();
+        length |= unsigned(in.byte()) << 8;
+        skip_bytes(in, length);
+    }
+    if (flags & gzip_flag_name) {
+        while (in.byte() != 0) { }
+    }
+    if (flags & gzip_flag_comment) {
+        while (in.byte() != 0) { }
+    }
+    if (flags & gzip_flag_hcrc) {
+        skip_bytes(in, 2);
+    }
+}
+
+/**
+ * Reads the trailer of a gzip member and checks it against the CRC-32
+ * and the size of the decompressed data.
+ */
+void read_gzip_trailer(BitReader& in, uint32_t crc, size_t size) {
+    in.align_to_byte();
+    uint32_t expected_crc = in.bits(32);
+    uint32_t expected_size = in.bits(32);
+
+    if (crc != expected_crc) {
+        throw std::runtime_error("Corrupted compressed input: CRC mismatch.");
+    }
+    if (uint32_t(size) != expected_size) {
+        throw std::runtime_error("Corrupted compressed input: length mismatch.");
+    }
+}
+
+
+/**
+ * Hands out a few bytes read in advance before the rest of the input,
+ * so the start of a stream can be inspected without seeking.
+ */
+struct PrefixedReader : Reader {
+
+    PrefixedReader(std::unique_ptr<Reader> reader, size_t prefix_size) : reader_(std::move(reader)) {
+        prefix_.resize(prefix_size);
+        size_t size = 0;
+        while (size < prefix_size) {
+            size_t n = reader_->read(prefix_.data() + size, prefix_size - size);
+            if (n == 0) {
+                break;
+            }
+            size += n;
+        }
+        prefix_.resize(size);
+    }
+
+    std::string_view prefix() const {
+        return prefix_;
+    }
+
+    size_t read(char* buffer, size_t size) override {
+        if (pos_ < prefix_.size()) {
+            size_t n = std::min(size, prefix_.size() - pos_);
+            std::memcpy(buffer, prefix_.data() + pos_, n);
+            pos_ += n;
+            return n;
+        }
+        return reader_->read(buffer, size);
+    }
+
+    std::string name() const override {
+        return reader_->name();
+    }
+
+private:
+    std::unique_ptr<Reader> reader_;
+    std::string prefix_;
+    size_t pos_ = 0;
+};
+
+
+/**
+ * Decompresses gzip (RFC 1952) data read by another reader.
+ *
+ * Files made of several concatenated gzip members are decompressed as one
+ * stream. Like gzip itself, anything following the last member that
+ * isn't another member is ignored.
+ *
+ * The decompressed bytes are written straight into the buffers of the
+ * caller, so wrapped into a `PipelinedSource` the decompression runs
+ * on the reader thread while the previous buffers are being parsed.
+ */
+struct GzipReader : Reader {
+
+    static constexpr size_t default_buffer_size = 1 << 20;
+
+    GzipReader(std::unique_ptr<Reader> reader, size_t buffer_size = default_buffer_size)
+        : reader_(std::move(reader)),
+          buffer_(buffer_size),
+          input_([this] { return Chunk{ buffer_.data(), reader_->read(buffer_.data(), buffer_.size()) }; }),
+          inflater_(input_) { }
+
+    size_t read(char* buffer, size_t size) override {
+        size_t total = 0;
+
+        while (total < size && !done_) {
+            if (!in_member_) {
+                in_member_ = read_member_header();
+                continue;
+            }
+
+            size_t n = inflater_.read(buffer + total, size - total);
+            crc_ = crc32_update(crc_, buffer + total, n);
+            member_size_ += n;
+            total += n;
+
+            if (inflater_.finished()) {
+                read_member_trailer();
+                inflater_.reset();
+                in_member_ = false;
+            }
+        }
+
+        return total;
+    }
+
+    std::string name() const override {
+        return reader_->name() + ", gzip";
+    }
+
+private:
+    /**
+     * Reads the header of the next member, returns false if there is none.
+     */
+    bool read_member_header() {
+        if (input_.at_end()) {
+            if (members_ == 0) {
+                throw std::runtime_error("The gzip input is empty.");
+            }
+            done_ = true;
+            return false;
+        }
+
+        if (members_ > 0 && !at_gzip_member(input_)) {
+            done_ = true;
+            return false;
+        }
+
+        read_gzip_header(input_);
+        return true;
+    }
+
+    void read_member_trailer() {
+        read_gzip_trailer(input_, crc_, member_size_);
+        crc_ = 0;
+        member_size_ = 0;
+        ++members_;
+    }
+
+    std::unique_ptr<Reader> reader_;
+    AlignedBuffer buffer_;
+    BitReader input_;
+    Inflater inflater_;
+
+    bool in_member_ = false;
+    bool done_ = false;
+    size_t members_ = 0;
+
+    uint32_t crc_ = 0;
+    size_t member_size_ = 0;
+};
@@ -0,0 +1,485 @@
+#include "inflate.hpp"
+
+#include <algorithm>
+#include <stdexcept>
+#include <utility>
+
+
+namespace {
+
+constexpr size_t window_size = 1 << 15;
+constexpr size_t window_mask = window_size - 1;
+
+constexpr uint16_t length_base[29] = {
+    3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31,
+    35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258
+};
+
+constexpr uint8_t length_extra[29] = {
+    0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2,
+    3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0
+};
+
+constexpr uint16_t distance_base[30] = {
+    1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193,
+    257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577
+};
+
+constexpr uint8_t distance_extra[30] = {
+    0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6,
+    7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13
+};
+
+// the order in which code length code lengths are stored in dynamic blocks
+constexpr uint8_t code_length_order[19] = {
+    16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15
+};
+
+[[noreturn]] void corrupted(const char* reason) {
+    throw std::runtime_error(std::string("Corrupted compressed input: ") + reason);
+}
+
+unsigned reverse_bits(unsigned code, unsigned length) {
+    unsigned res = 0;
+    for (unsigned i = 0; i < length; ++i) {
+        res = (res << 1) | (code & 1);
+        code >>= 1;
+    }
+    return res;
+}
+
+} // namespace
+
+
+void BitReader::copy_bytes(char* out, size_t size) {
+    // first the whole bytes which are still in the bit buffer
+    while (size > 0 && count_ >= 8) {
+        if (count_/8 <= padding_) {
+            corrupted("unexpected end of data");
+        }
+        *out++ = char(bits_ & 0xFF);
+        consume(8);
+        --size;
+    }
+
+    if (size == 0) {
+        return;
+    }
+
+    // the bit buffer is empty, but it might hold stale bits past the count
+    bits_ = 0;
+    count_ = 0;
+
+    while (size > 0) {
+        if (pos_ == end_ && !next_chunk()) {
+            corrupted("unexpected end of data");
+        }
+        size_t n = std::min<size_t>(size, end_ - pos_);
+        std::memcpy(out, pos_, n);
+        pos_ += n;
+        out += n;
+        size -= n;
+    }
+}
+
+bool BitReader::at_end() {
+    if (count_/8 > padding_ || pos_ < end_) {
+        return false;
+    }
+    return padding_ > 0 || !next_chunk();
+}
+
+void BitReader::refill_slow() {
+    while (count_ <= 56) {
+        if (pos_ == end_ && !next_chunk()) {
+            if (++padding_ > 8) {
+                corrupted("unexpected end of data");
+            }
+            count_ += 8;
+            continue;
+        }
+        bits_ |= uint64_t(uint8_t(*pos_++)) << count_;
+        count_ += 8;
+    }
+}
+
+bool BitReader::next_chunk() {
+    if (padding_ > 0) {
+        return false;
+    }
+
+    Chunk chunk = input_();
+    pos_ = chunk.data;
+    end_ = chunk.data + chunk.size;
+
+    return chunk.size > 0;
+}
+
+
+void Huffman::build(const uint8_t* lengths, size_t n) {
+    count_.fill(0);
+    for (size_t i = 0; i < n; ++i) {
+        count_[lengths[i]]++;
+    }
+    count_[0] = 0;
+
+    int left = 1;
+    for (unsigned len = 1; len <= max_length; ++len) {
+        left <<= 1;
+        left -= count_[len];
+        if (left < 0) {
+            corrupted("over-subscribed Huffman code");
+        }
+    }
+
+    std::array<uint16_t, max_length + 2> offsets;
+    offsets[1] = 0;
+    for (unsigned len = 1; len <= max_length; ++len) {
+        offsets[len + 1] = offsets[len] + count_[len];
+    }
+
+    for (size_t sym = 0; sym < n; ++sym) {
+        if (lengths[sym] != 0) {
+            symbols_[offsets[lengths[sym]]++] = sym;
+        }
+    }
+
+    // codes are assigned in the order of the sorted symbols, the table
+    // is indexed by the bits as they come from the stream, i.e. reversed
+    fast_.fill(0);
+    unsigned code = 0;
+    size_t index = 0;
+    for (unsigned len = 1; len <= fast_bits; ++len) {
+        for (unsigned k = 0; k < count_[len]; ++k) {
+            uint16_t entry = symbols_[index++] << 4 | len;
+            for (unsigned j = reverse_bits(code, len); j < fast_.size(); j += 1u << len) {
+                fast_[j] = entry;
+            }
+            ++code;
+        }
+        code <<= 1;
+    }
+}
+
+unsigned Huffman::decode_slow(BitReader& in) const {
+    uint64_t bits = in.peek(max_length);
+
+    int code = 0;
+    int first = 0;
+    int index = 0;
+    for (unsigned len = 1; len <= max_length; ++len) {
+        code |= bits & 1;
+        bits >>= 1;
+
+        int count = count_[len];
+        if (code - count < first) {
+            in.consume(len);
+            return symbols_[index + (code - first)];
+        }
+
+        index += count;
+        first += count;
+        first <<= 1;
+        code <<= 1;
+    }
+
+    corrupted("invalid Huffman code");
+}
+
+
+Inflater::Inflater(BitReader& in) : in_(in), window_(window_size) { }
+
+size_t Inflater::read(char* out, size_t size) {
+    out_ = out;
+    out_pos_ = 0;
+    out_end_ = size;
+
+    while (out_pos_ < out_end_ && state_ != State::done) {
+        switch (state_) {
+            case State::block_header:
+                read_block_header();
+                break;
+            case State::stored:
+                decode_stored();
+                break;
+            case State::huffman:
+                decode_huffman();
+                break;
+            case State::done:
+                break;
+        }
+    }
+
+    // a buffer filled up to the end of the stream needs no history
+    if (out_pos_ == out_end_) {
+        skip_end_of_block();
+    }
+    if (state_ != State::done) {
+        keep_history();
+    }
+
+    return out_pos_;
+}
+
+void Inflater::reset() {
+    state_ = State::block_header;
+    last_block_ = false;
+    match_length_ = 0;
+    window_pos_ = 0;
+    history_ = 0;
+}
+
+void Inflater::skip_end_of_block() {
+    if (state_ != State::huffman || match_length_ > 0) {
+        return;
+    }
+
+    in_.refill();
+    if (litlen_.skip(in_, 256)) {
+        state_ = last_block_ ? State::done : State::block_header;
+    }
+}
+
+void Inflater::keep_history() {
+    if (out_pos_ >= window_size) {
+        std::memcpy(window_.data(), out_ + out_pos_ - window_size, window_size);
+        window_pos_ = 0;
+        history_ = window_size;
+        return;
+    }
+
+    size_t first = std::min(out_pos_, window_size - window_pos_);
+    std::memcpy(window_.data() + window_pos_, out_, first);
+    std::memcpy(window_.data(), out_ + first, out_pos_ - first);
+    window_pos_ = (window_pos_ + out_pos_) & window_mask;
+    history_ = std::min(window_size, history_ + out_pos_);
+}
+
+void Inflater::read_block_header() {
+    last_block_ = in_.bits(1);
+    unsigned type = in_.bits(2);
+
+    if (type == 0) {
+        in_.align_to_byte();
+        unsigned length = in_.bits(16);
+        unsigned inverted = in_.bits(16);
+        if (length != (~inverted & 0xFFFF)) {
+            corrupted("invalid stored block length");
+        }
+        stored_remaining_ = length;
+        state_ = State::stored;
+    } else if (type == 1) {
+        std::array<uint8_t, 288 + 30> lengths;
+        std::fill(lengths.begin(), lengths.begin() + 144, 8);
+        std::fill(lengths.begin() + 144, lengths.begin() + 256, 9);
+        std::fill(lengths.begin() + 256, lengths.begin() + 280, 7);
+        std::fill(lengths.begin() + 280, lengths.begin() + 288, 8);
+        std::fill(lengths.begin() + 288, lengths.end(), 5);
+        litlen_.build(lengths.data(), 288);
+        dist_.build(lengths.data() + 288, 30);
+        state_ = State::huffman;
+    } else if (type == 2) {
+        read_dynamic_tables();
+        state_ = State::huffman;
+    } else {
+        corrupted("invalid block type");
+    }
+}
+
+void Inflater::read_dynamic_tables() {
+    unsigned litlen_count = in_.bits(5) + 257;
+    unsigned dist_count = in_.bits(5) + 1;
+    unsigned code_length_count = in_.bits(4) + 4;
+
+    if (litlen_count > 286 || dist_count > 30) {
+        corrupted("too many length or distance codes");
+    }
+
+    std::array<uint8_t, 19> code_length_lengths = { 0 };
+    for (unsigned i = 0; i < code_length_count; ++i) {
+        code_length_lengths[code_length_order[i]] = in_.bits(3);
+    }
+
+    Huffman code_lengths;
+    code_lengths.build(code_length_lengths.data(), code_length_lengths.size());
+
+    std::array<uint8_t, 286 + 30> lengths;
+    unsigned total = litlen_count + dist_count;
+    unsigned i = 0;
+
+    while (i < total) {
+        in_.refill();
+        unsigned sym = code_lengths.decode(in_);
+
+        if (sym < 16) {
+            lengths[i++] = sym;
+            continue;
+        }
+
+        uint8_t value = 0;
+        unsigned repeat;
+        if (sym == 16) {
+            if (i == 0) {
+                corrupted("repeated code length without a previous one");
+            }
+            value = lengths[i - 1];
+            repeat = 3 + in_.bits(2);
+        } else if (sym == 17) {
+            repeat = 3 + in_.bits(3);
+        } else {
+            repeat = 11 + in_.bits(7);
+        }
+
+        if (i + repeat > total) {
+            corrupted("too many code lengths");
+        }
+
+        std::fill_n(lengths.begin() + i, repeat, value);
+        i += repeat;
+    }
+
+    if (lengths[256] == 0) {
+        corrupted("missing end-of-block code");
+    }
+
+    litlen_.build(lengths.data(), litlen_count);
+    dist_.build(lengths.data() + litlen_count, dist_count);
+}
+
+void Inflater::decode_stored() {
+    size_t n = std::min(stored_remaining_, out_end_ - out_pos_);
+    in_.copy_bytes(out_ + out_pos_, n);
+    out_pos_ += n;
+    stored_remaining_ -= n;
+
+    if (stored_remaining_ == 0) {
+        state_ = last_block_ ? State::done : State::block_header;
+    }
+}
+
+void Inflater::decode_huffman() {
+    if (match_length_ > 0) {
+        copy_match(std::exchange(match_length_, 0), match_distance_);
+    }
+
+    char* out = out_;
+    size_t pos = out_pos_;
+    size_t end = out_end_;
+
+    // one refill is enough for the longest symbol: 15 + 5 + 15 + 13 bits
+    while (pos < end) {
+        in_.refill();
+        unsigned sym = litlen_.decode(in_);
+
+        if (sym < 256) {
+            out[pos++] = char(sym);
+            continue;
+        }
+
+        if (sym == 256) {
+            state_ = last_block_ ? State::done : State::block_header;
+            break;
+        }
+
+        sym -= 257;
+        if (sym >= 29) {
+            corrupted("invalid length symbol");
+        }
+        size_t length = length_base[sym] + in_.peek(length_extra[sym]);
+        in_.consume(length_extra[sym]);
+
+        unsigned dist_sym = dist_.decode(in_);
+        if (dist_sym >= 30) {
+            corrupted("invalid distance symbol");
+        }
+        size_t distance = distance_base[dist_sym] + in_.peek(distance_extra[dist_sym]);
+        in_.consume(distance_extra[dist_sym]);
+
+        if (distance > pos || length > end - pos) {
+            out_pos_ = pos;
+            copy_match(length, distance);
+            pos = out_pos_;
+            continue;
+        }
+
+        const char* src = out + pos - distance;
+        char* dst = out + pos;
+        if (distance >= length) {
+            std::memcpy(dst, src, length);
+        } else {
+            for (size_t i = 0; i < length; ++i) {
+                dst[i] = src[i];
+            }
+        }
+        pos += length;
+    }
+
+    out_pos_ = pos;
+}
+
+void Inflater::copy_match(size_t length, size_t distance) {
+    if (distance > out_pos_ + history_) {
+        corrupted("distance too far back");
+    }
+
+    // the rest of a match which doesn't fit is copied by the next read
+    size_t n = std::min(length, out_end_ - out_pos_);
+    match_length_ = length - n;
+    match_distance_ = distance;
+
+    // the start of the match might be in the history of the previous reads
+    for (size_t i = out_pos_; i < out_pos_ + n; ++i) {
+        out_[i] = i < distance ? window_[(window_pos_ + i - distance) & window_mask] : out_[i - distance];
+    }
+    out_pos_ += n;
+}
+
+
+namespace {
+
+struct Crc32Tables {
+    uint32_t table[8][256];
+
+    Crc32Tables() {
+        for (uint32_t i = 0; i < 256; ++i) {
+            uint32_t crc = i;
+            for (int k = 0; k < 8; ++k) {
+                crc = (crc >> 1) ^ (0xEDB88320 & (0 - (crc & 1)));
+            }
+            table[0][i] = crc;
+        }
+        for (int k = 1; k < 8; ++k) {
+            for (uint32_t i = 0; i < 256; ++i) {
+                table[k][i] = (table[k - 1][i] >> 8) ^ table[0][table[k - 1][i] & 0xFF];
+            }
+        }
+    }
+};
+
+} // namespace
+
+uint32_t crc32_update(uint32_t crc, const char* data, size_t size) {
+    // slicing-by-8, assumes a little-endian machine
+    static const Crc32Tables tables;
+    const auto& t = tables.table;
+
+    const unsigned char* p = reinterpret_cast<const unsigned char*>(data);
+    crc = ~crc;
+
+    while (size >= 8) {
+        uint32_t lo, hi;
+        std::memcpy(&lo, p, 4);
+        std::memcpy(&hi, p + 4, 4);
+        lo ^= crc;
+        crc = t[7][lo & 0xFF] ^ t[6][(lo >> 8) & 0xFF] ^ t[5][(lo >> 16) & 0xFF] ^ t[4][lo >> 24]
+            ^ t[3][hi & 0xFF] ^ t[2][(hi >> 8) & 0xFF] ^ t[1][(hi >> 16) & 0xFF] ^ t[0][hi >> 24];
+        p += 8;
+        size -= 8;
+    }
+
+    while (size-- > 0) {
+        crc = t[0][(crc ^ *p++) & 0xFF] ^ (crc >> 8);
+    }
+
+    return ~crc;
+}
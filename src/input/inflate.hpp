@@ -0,0 +1,238 @@
+#pragma once
+
+#include "source.hpp"
+
+#include <array>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <vector>
+
+
+/**
+ * Reads bits, least significant first, from compressed input which is
+ * pulled in chunks on demand.
+ *
+ * Past the end of the input the reader supplies zero bits, so the decoder
+ * doesn't have to check for the end before every symbol. Consuming more
+ * than a few bytes of this padding means the input was truncated
+ * and results in an exception.
+ */
+class BitReader {
+public:
+    using InputFn = std::function<Chunk()>;
+
+    explicit BitReader(InputFn input) : input_(std::move(input)) { }
+
+    /**
+     * Makes sure there are at least 56 bits in the bit buffer.
+     */
+    void refill() {
+        if (count_ > 56) {
+            return;
+        }
+
+        if (end_ - pos_ >= 8) {
+            uint64_t word;
+            std::memcpy(&word, pos_, 8);
+            bits_ |= word << count_;
+            pos_ += (63 - count_) >> 3;
+            count_ |= 56;
+            return;
+        }
+
+        refill_slow();
+    }
+
+    uint64_t peek(unsigned n) const {
+        return bits_ & ((uint64_t(1) << n) - 1);
+    }
+
+    void consume(unsigned n) {
+        bits_ >>= n;
+        count_ -= n;
+    }
+
+    /**
+     * Reads `n` bits, `n` has to be at most 32.
+     */
+    uint32_t bits(unsigned n) {
+        refill();
+        uint32_t val = peek(n);
+        consume(n);
+        return val;
+    }
+
+    /**
+     * Drops the bits up to the next byte boundary.
+     */
+    void align_to_byte() {
+        consume(count_ % 8);
+    }
+
+    uint8_t byte() {
+        return bits(8);
+    }
+
+    /**
+     * Copies `size` bytes to `out`, the reader has to be byte-aligned.
+     */
+    void copy_bytes(char* out, size_t size);
+
+    /**
+     * Returns true if all of the input was consumed.
+     * Might block waiting for more input.
+     */
+    bool at_end();
+
+    /**
+     * Drops everything buffered, the next bits come from a new chunk of input.
+     */
+    void reset() {
+        pos_ = end_ = nullptr;
+        bits_ = 0;
+        count_ = 0;
+        padding_ = 0;
+    }
+
+private:
+    void refill_slow();
+    bool next_chunk();
+
+    InputFn input_;
+
+    const char* pos_ = nullptr;
+    const char* end_ = nullptr;
+
+    uint64_t bits_ = 0;
+    unsigned count_ = 0;
+
+    // zero bytes appended to the input after its end
+    size_t padding_ = 0;
+};
+
+
+/**
+ * Canonical Huffman code of DEFLATE, decoded with a lookup table for short
+ * codes and bit by bit for the rest.
+ */
+class Huffman {
+public:
+    static constexpr unsigned max_length = 15;
+    static constexpr unsigned fast_bits = 10;
+
+    /**
+     * Builds the code from the code lengths of `n` symbols.
+     * Throws std::runtime_error if the lengths don't describe a valid code.
+     */
+    void build(const uint8_t* lengths, size_t n);
+
+    /**
+     * Decodes one symbol, the bit reader has to hold at least 15 bits.
+     */
+    unsigned decode(BitReader& in) const {
+        uint16_t entry = fast_[in.peek(fast_bits)];
+        if (entry != 0) {
+            in.consume(entry & 0xF);
+            return entry >> 4;
+        }
+        return decode_slow(in);
+    }
+
+    /**
+     * Consumes the next symbol if it is `symbol` with a code short enough
+     * for the lookup table, otherwise leaves the input alone.
+     */
+    bool skip(BitReader& in, unsigned symbol) const {
+        uint16_t entry = fast_[in.peek(fast_bits)];
+        if (entry != 0 && entry >> 4 == symbol) {
+            in.consume(entry & 0xF);
+            return true;
+        }
+        return false;
+    }
+
+private:
+    unsigned decode_slow(BitReader& in) const;
+
+    // symbol << 4 | code length, 0 for codes longer than `fast_bits`
+    std::array<uint16_t, 1 << fast_bits> fast_;
+
+    std::array<uint16_t, max_length + 1> count_;
+    std::array<uint16_t, 288> symbols_;
+};
+
+
+/**
+ * Streaming decoder of raw DEFLATE data (RFC 1951).
+ *
+ * The output is decoded straight into the buffer given to `read`. Only the
+ * last 32 KB of it are copied into a ring, the history for back-references
+ * reaching before the buffer of the next `read`. A read which ends exactly
+ * with the stream, like the whole member of a known size, copies nothing.
+ */
+class Inflater {
+public:
+    explicit Inflater(BitReader& in);
+
+    /**
+     * Decompresses up to `size` bytes into `out` and returns how many were
+     * written. Returns 0 only once the end of the stream was reached.
+     * Throws std::runtime_error on corrupted data.
+     */
+    size_t read(char* out, size_t size);
+
+    bool finished() const {
+        return state_ == State::done;
+    }
+
+    /**
+     * Prepares the decoder for the next stream which follows in the same input.
+     */
+    void reset();
+
+private:
+    enum class State {
+        block_header,
+        stored,
+        huffman,
+        done
+    };
+
+    void read_block_header();
+    void read_dynamic_tables();
+    void decode_stored();
+    void decode_huffman();
+    void copy_match(size_t length, size_t distance);
+    void skip_end_of_block();
+    void keep_history();
+
+    BitReader& in_;
+
+    State state_ = State::block_header;
+    bool last_block_ = false;
+    size_t stored_remaining_ = 0;
+
+    Huffman litlen_;
+    Huffman dist_;
+
+    // the buffer of the current `read`
+    char* out_ = nullptr;
+    size_t out_pos_ = 0;
+    size_t out_end_ = 0;
+
+    // the rest of a match which didn't fit into the previous buffer
+    size_t match_length_ = 0;
+    size_t match_distance_ = 0;
+
+    // the output of the previous reads, `history_` bytes before `window_pos_`
+    std::vector<char> window_;
+    size_t window_pos_ = 0;
+    size_t history_ = 0;
+};
+
+
+/**
+ * Updates the CRC-32 (as used by gzip) of a stream with `size` more bytes.
+ */
+uint32_t crc32_update(uint32_t crc, const char* data, size_t size);
@@ -0,0 +1,137 @@
+#pragma once
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "source.hpp"
+
+#include <algorithm>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <utility>
+
+
+/**
+ * Read-only memory mapping of a whole regular file.
+ *
+ * The mapping is advised as sequential so the kernel reads ahead aggressively
+ * and drops pages behind us instead of keeping the whole file resident.
+ */
+struct MappedFile {
+
+    /**
+     * Maps the file at `path` into memory.
+     *
+     * Returns nullopt if the file can't be opened, isn't a regular file
+     * (pipes, character devices, ...) or is empty. In that case the caller
+     * should fall back to reading the file as a stream.
+     */
+    static std::optional<MappedFile> open(const std::string& path) {
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0) {
+            return std::nullopt;
+        }
+
+        auto file = map(fd);
+        ::close(fd);
+
+        return file;
+    }
+
+    /**
+     * Same as `open`, but throws std::runtime_error if the file can't be mapped.
+     */
+    static MappedFile open_or_throw(const std::string& path) {
+        auto file = open(path);
+        if (!file) {
+            throw std::runtime_error("Failed to map '" + path + "'.");
+        }
+        return std::move(*file);
+    }
+
+    /**
+     * Maps the whole file referred to by the open descriptor `fd`,
+     * regardless of its current offset. The descriptor stays open.
+     */
+    static std::optional<MappedFile> map(int fd) {
+        struct stat st;
+        if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode) || st.st_size == 0) {
+            return std::nullopt;
+        }
+
+        size_t size = st.st_size;
+        void* addr = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+
+        if (addr == MAP_FAILED) {
+            return std::nullopt;
+        }
+
+        madvise(addr, size, MADV_SEQUENTIAL);
+
+        return MappedFile(static_cast<const char*>(addr), size);
+    }
+
+    MappedFile(MappedFile&& other) noexcept
+        : data_(std::exchange(other.data_, nullptr)),
+          size_(std::exchange(other.size_, 0)) { }
+
+    MappedFile& operator=(MappedFile&& other) noexcept {
+        std::swap(data_, other.data_);
+        std::swap(size_, other.size_);
+        return *this;
+    }
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    ~MappedFile() {
+        if (data_) {
+            munmap(const_cast<char*>(data_), size_);
+        }
+    }
+
+    const char* data() const {
+        return data_;
+    }
+
+    size_t size() const {
+        return size_;
+    }
+
+private:
+    MappedFile(const char* data, size_t size) : data_(data), size_(size) { }
+
+    const char* data_;
+    size_t size_;
+};
+
+
+/**
+ * Delivers the whole mapped file, starting at `offset`, as a single chunk.
+ */
+struct MappedSource : InputSource {
+
+    MappedSource(MappedFile file, size_t offset = 0)
+        : file_(std::move(file)),
+          offset_(std::min(offset, file_.size())) { }
+
+    Chunk next() override {
+        if (done_) {
+            return { file_.data() + file_.size(), 0 };
+        }
+        done_ = true;
+        return { file_.data() + offset_, file_.size() - offset_ };
+    }
+
+    std::string name() const override {
+        return "mmap";
+    }
+
+private:
+    MappedFile file_;
+    size_t offset_;
+    bool done_ = false;
+};
@@ -0,0 +1,135 @@
+#pragma once
+
+#include "source.hpp"
+#include "reader.hpp"
+#include "aligned_buffer.hpp"
+
+#include <condition_variable>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+
+/**
+ * Reads the input on a separate thread into a ring of buffers.
+ *
+ * While the consumer parses one buffer the reader thread fills the others,
+ * so waiting for I/O overlaps with parsing and the throughput is bound by
+ * the slower of the two instead of their sum.
+ */
+struct PipelinedSource : InputSource {
+
+    static constexpr size_t default_buffer_count = 4;
+    static constexpr size_t default_buffer_size = 1 << 22;
+
+    PipelinedSource(std::unique_ptr<Reader> reader,
+                    size_t buffer_count = default_buffer_count,
+                    size_t buffer_size = default_buffer_size)
+        : reader_(std::move(reader)),
+          sizes_(buffer_count, 0)
+    {
+        for (size_t i = 0; i < buffer_count; ++i) {
+            buffers_.emplace_back(buffer_size);
+        }
+        thread_ = std::thread([this] { read_loop(); });
+    }
+
+    ~PipelinedSource() {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            stopped_ = true;
+        }
+        released_.notify_one();
+        thread_.join();
+    }
+
+    Chunk next() override {
+        std::unique_lock<std::mutex> lock(mutex_);
+
+        // the previously returned buffer can be refilled now
+        if (holding_) {
+            holding_ = false;
+            --filled_;
+            consumer_index_ = (consumer_index_ + 1) % buffers_.size();
+            released_.notify_one();
+        }
+
+        filled_cv_.wait(lock, [this] { return filled_ > 0 || finished_; });
+
+        if (filled_ == 0) {
+            if (error_) {
+                std::rethrow_exception(error_);
+            }
+            return { nullptr, 0 };
+        }
+
+        holding_ = true;
+        return { buffers_[consumer_index_].data(), sizes_[consumer_index_] };
+    }
+
+    std::string name() const override {
+        return reader_->name() + ", pipelined";
+    }
+
+private:
+    void read_loop() {
+        size_t index = 0;
+
+        try {
+            while (true) {
+                {
+                    std::unique_lock<std::mutex> lock(mutex_);
+                    released_.wait(lock, [this] { return filled_ < buffers_.size() || stopped_; });
+                    if (stopped_) {
+                        return;
+                    }
+                }
+
+                // the buffer at `index` isn't visible to the consumer, so it can be filled without the lock
+                size_t size = reader_->read(buffers_[index].data(), buffers_[index].size());
+                if (size == 0) {
+                    break;
+                }
+
+                {
+                    std::lock_guard<std::mutex> lock(mutex_);
+                    sizes_[index] = size;
+                    ++filled_;
+                }
+                filled_cv_.notify_one();
+
+                index = (index + 1) % buffers_.size();
+            }
+        } catch (...) {
+            std::lock_guard<std::mutex> lock(mutex_);
+            error_ = std::current_exception();
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            finished_ = true;
+        }
+        filled_cv_.notify_one();
+    }
+
+    std::unique_ptr<Reader> reader_;
+
+    std::vector<AlignedBuffer> buffers_;
+    std::vector<size_t> sizes_;
+
+    std::mutex mutex_;
+    std::condition_variable filled_cv_;
+    std::condition_variable released_;
+
+    size_t filled_ = 0;
+    size_t consumer_index_ = 0;
+    bool holding_ = false;
+    bool finished_ = false;
+    bool stopped_ = false;
+    std::exception_ptr error_;
+
+    std::thread thread_;
+};
@@ -0,0 +1,239 @@
+#pragma once
+
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstring>
+#include <fstream>
+#include <istream>
+#include <memory>
+#include <stdexcept>
+#include <string>
+
+
+/**
+ * Something that can fill a caller-provided buffer with input bytes.
+ *
+ * Unlike an `InputSource` a reader doesn't own any buffers, which lets
+ * sources decide how the memory is managed (one reusable buffer, a ring
+ * of buffers filled by another thread, ...).
+ */
+struct Reader {
+
+    /**
+     * Reads up to `size` bytes into `buffer` and returns the number of bytes read.
+     * Returns 0 only at the end of the input. Throws std::runtime_error
+     * if the input can't be read.
+     */
+    virtual size_t read(char* buffer, size_t size) = 0;
+
+    /**
+     * Short name of the reader used in verbose output.
+     */
+    virtual std::string name() const = 0;
+
+    virtual ~Reader() = default;
+};
+
+
+/**
+ * Reads from a std::istream.
+ */
+struct StreamReader : Reader {
+
+    StreamReader(std::istream& stream) : stream_(stream) { }
+
+    StreamReader(const std::string& path)
+        : file_(std::make_unique<std::ifstream>(path, std::ios::binary)),
+          stream_(*file_) { }
+
+    size_t read(char* buffer, size_t size) override {
+        if (!stream_) {
+            return 0;
+        }
+
+        stream_.read(buffer, size);
+
+        if (stream_.bad()) {
+            throw std::runtime_error("Failed to read the input.");
+        }
+
+        return stream_.gcount();
+    }
+
+    std::string name() const override {
+        return "stream";
+    }
+
+private:
+    std::unique_ptr<std::ifstream> file_;
+    std::istream& stream_;
+};
+
+
+/**
+ * How a `FileReader` treats the page cache.
+ */
+enum class CacheMode {
+    normal,      // read through the page cache with readahead
+    direct,      // bypass the page cache with O_DIRECT
+    drop_behind  // read through the page cache and evict what was read
+};
+
+
+/**
+ * Reads a file with plain read(2) calls.
+ *
+ * Normally the kernel is told the file is read sequentially and the reader
+ * asks it to prefetch the range following each read, so the next read usually
+ * finds its data already in the page cache.
+ *
+ * When the reader is supposed to leave the page cache alone it opens the file
+ * with O_DIRECT. That requires the buffers, their sizes and the file offsets
+ * to be aligned to the block size, which holds as long as the buffers are
+ * `AlignedBuffer`s with a size that is a multiple of 4096. If the filesystem
+ * doesn't support O_DIRECT, the ranges which were read are evicted from
+ * the page cache instead.
+ */
+struct FileReader : Reader {
+
+    /**
+     * Opens the file at `path`, returns nullptr if it can't be opened.
+     */
+    static std::unique_ptr<FileReader> open(const std::string& path, bool bypass_cache = false) {
+        if (bypass_cache) {
+            int fd = ::open(path.c_str(), O_RDONLY | O_DIRECT);
+            if (fd >= 0) {
+                return std::unique_ptr<FileReader>(new FileReader(fd, CacheMode::direct));
+            }
+        }
+
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0) {
+            return nullptr;
+        }
+        return std::unique_ptr<FileReader>(new FileReader(fd, bypass_cache ? CacheMode::drop_behind : CacheMode::normal));
+    }
+
+    /**
+     * Reads from an already open descriptor, e.g. the standard input.
+     * The descriptor is left open.
+     *
+     * If it is a pipe, its capacity is raised so the producer can keep
+     * writing while we parse, instead of blocking after 64 KB. Moving the
+     * data with splice(2) or vmsplice(2) wouldn't help, since the bytes
+     * have to end up in our memory to be parsed, which is exactly what
+     * read(2) does with one copy.
+     */
+    static std::unique_ptr<FileReader> from_fd(int fd) {
+        struct stat st;
+        if (fstat(fd, &st) == 0 && S_ISFIFO(st.st_mode)) {
+            fcntl(fd, F_SETPIPE_SZ, pipe_size);
+        }
+
+        auto reader = std::unique_ptr<FileReader>(new FileReader(fd, CacheMode::normal));
+        reader->owns_fd_ = false;
+        return reader;
+    }
+
+    ~FileReader() {
+        if (owns_fd_) {
+            ::close(fd_);
+        }
+    }
+
+    size_t read(char* buffer, size_t size) override {
+        if (eof_) {
+            return 0;
+        }
+
+        if (mode_ == CacheMode::normal && readahead_) {
+            posix_fadvise(fd_, offset_ + size, size, POSIX_FADV_WILLNEED);
+        }
+
+        size_t total = 0;
+        while (total < size) {
+            ssize_t res = ::read(fd_, buffer + total, size - total);
+            if (res < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                throw std::runtime_error(std::string("Failed to read the input: ") + std::strerror(errno));
+            }
+            if (res == 0) {
+                eof_ = true;
+                break;
+            }
+            total += res;
+
+            if (mode_ == CacheMode::direct && total < size) {
+                if (offset_ + total >= file_size_) {
+                    eof_ = true;
+                    break;
+                }
+                // cut short in the middle of the file, e.g. by a signal,
+                // and direct reads from an unaligned offset would fail
+                if ((offset_ + total) % direct_alignment != 0) {
+                    leave_direct_io();
+                }
+            }
+        }
+
+        if (mode_ == CacheMode::drop_behind) {
+            posix_fadvise(fd_, offset_, total, POSIX_FADV_DONTNEED);
+        }
+
+        offset_ += total;
+        return total;
+    }
+
+    std::string name() const override {
+        switch (mode_) {
+            case CacheMode::direct:
+                return "read (O_DIRECT)";
+            case CacheMode::drop_behind:
+                return "read (dropping cache)";
+            default:
+                return "read";
+        }
+    }
+
+private:
+    FileReader(int fd, CacheMode mode) : fd_(fd), mode_(mode) {
+        // fails for pipes and the like, which don't have a page cache to prefetch into
+        readahead_ = posix_fadvise(fd_, 0, 0, POSIX_FADV_SEQUENTIAL) == 0;
+
+        // tells a short direct read at the end of the file from one cut short
+        struct stat st;
+        if (mode_ == CacheMode::direct && fstat(fd_, &st) == 0) {
+            file_size_ = st.st_size;
+        }
+    }
+
+    /**
+     * Reads the rest of the file through the page cache, evicting it
+     * behind the reader like when O_DIRECT isn't supported.
+     */
+    void leave_direct_io() {
+        int flags = fcntl(fd_, F_GETFL);
+        if (flags < 0 || fcntl(fd_, F_SETFL, flags & ~O_DIRECT) != 0) {
+            throw std::runtime_error(std::string("Failed to read the input: ") + std::strerror(errno));
+        }
+        mode_ = CacheMode::drop_behind;
+    }
+
+    static constexpr size_t direct_alignment = 4096;
+
+    // the default limit for unprivileged processes
+    static constexpr int pipe_size = 1 << 20;
+
+    int fd_;
+    bool owns_fd_ = true;
+    CacheMode mode_;
+    size_t offset_ = 0;
+    size_t file_size_ = 0;
+    bool readahead_;
+    bool eof_ = false;
+};
@@ -0,0 +1,112 @@
+#pragma once
+
+#include <cstddef>
+#include <streambuf>
+#include <string>
+
+
+/**
+ * A contiguous piece of the input.
+ */
+struct Chunk {
+    const char* data;
+    size_t size;
+};
+
+
+/**
+ * Source of input bytes which are delivered in chunks.
+ *
+ * The memory of a chunk is owned by the source and stays valid only
+ * until the following call to `next`, which allows sources to reuse
+ * their buffers or to hand out memory they don't copy at all.
+ */
+struct InputSource {
+
+    /**
+     * Returns the next chunk of the input. An empty chunk marks the end
+     * of the input. Throws std::runtime_error if the input can't be read.
+     */
+    virtual Chunk next() = 0;
+
+    /**
+     * Short name of the backend used in verbose output.
+     */
+    virtual std::string name() const = 0;
+
+    virtual ~InputSource() = default;
+};
+
+
+/**
+ * Stream buffer which reads directly from the chunks of an `InputSource`.
+ *
+ * The header parser works with std::istream, so it reads the input through
+ * this buffer. The entries are then read chunk by chunk starting with
+ * whatever is left in the buffer after the header, without any copying.
+ */
+struct SourceBuf : std::streambuf {
+
+    SourceBuf(InputSource& source) : source_(source) { }
+
+    /**
+     * Returns the part of the current chunk which wasn't read yet
+     * and marks it as consumed.
+     */
+    Chunk buffered() {
+        Chunk chunk = { gptr(), size_t(egptr() - gptr()) };
+        setg(eback(), egptr(), egptr());
+        return chunk;
+    }
+
+    /**
+     * Returns the part of the current chunk which wasn't read yet without
+     * consuming it. If the chunk is used up, the next one is loaded first.
+     */
+    Chunk peek() {
+        if (gptr() == egptr()) {
+            underflow();
+        }
+        return { gptr(), size_t(egptr() - gptr()) };
+    }
+
+    /**
+     * Returns the next chunk of the underlying source,
+     * bypassing the stream buffer.
+     */
+    Chunk next() {
+        Chunk chunk = source_.next();
+        bytes_read_ += chunk.size;
+        setg(nullptr, nullptr, nullptr);
+        return chunk;
+    }
+
+    size_t bytes_read() const {
+        return bytes_read_;
+    }
+
+    InputSource& source() {
+        return source_;
+    }
+
+protected:
+    int_type underflow() override {
+        if (gptr() < egptr()) {
+            return traits_type::to_int_type(*gptr());
+        }
+
+        Chunk chunk = next();
+        if (chunk.size == 0) {
+            return traits_type::eof();
+        }
+
+        char* data = const_cast<char*>(chunk.data);
+        setg(data, data, data + chunk.size);
+
+        return traits_type::to_int_type(*data);
+    }
+
+private:
+    InputSource& source_;
+    size_t bytes_read_ = 0;
+};
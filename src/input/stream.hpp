@@ -0,0 +1,33 @@
+#pragma once
+
+#include "source.hpp"
+#include "reader.hpp"
+#include "aligned_buffer.hpp"
+
+#include <memory>
+#include <string>
+
+
+/**
+ * Reads the input with a `Reader` into one reusable buffer.
+ */
+struct BufferedSource : InputSource {
+
+    static constexpr size_t default_buffer_size = 1 << 18;
+
+    BufferedSource(std::unique_ptr<Reader> reader, size_t buffer_size = default_buffer_size)
+        : reader_(std::move(reader)),
+          buffer_(buffer_size) { }
+
+    Chunk next() override {
+        return { buffer_.data(), reader_->read(buffer_.data(), buffer_.size()) };
+    }
+
+    std::string name() const override {
+        return reader_->name();
+    }
+
+private:
+    std::unique_ptr<Reader> reader_;
+    AlignedBuffer buffer_;
+};
@@ -0,0 +1,282 @@
+#pragma once
+
+#include "source.hpp"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+
+
+/**
+ * A member of a tar archive.
+ */
+struct TarEntry {
+    std::string name;
+    size_t size;
+    bool regular;   // a regular file, as opposed to directories, links, ...
+};
+
+
+/**
+ * Walks through a tar archive (ustar, pax or GNU) delivered by an input
+ * source, without extracting anything.
+ *
+ * The data of the current entry is handed out by `data` in pieces of
+ * the archive's chunks, so it is never copied. Whatever isn't read
+ * is skipped by `next`, which for a mapped archive is just moving
+ * a pointer, so the skipped members are never even paged in.
+ */
+class TarReader {
+public:
+    static constexpr size_t block_size = 512;
+
+    explicit TarReader(InputSource& archive) : archive_(archive) { }
+
+    /**
+     * Skips the rest of the current entry and reads the header of the next one.
+     * Returns nullopt at the end of the archive. Throws std::runtime_error
+     * if the archive is malformed.
+     */
+    std::optional<TarEntry> next() {
+        skip(remaining_ + padding_);
+        remaining_ = padding_ = 0;
+
+        std::string long_name;
+        std::optional<size_t> long_size;
+
+        while (true) {
+            char header[block_size];
+            size_t n = read(header, block_size);
+
+            // the archive should end with zero blocks, but a plain end is fine as well
+            if (n == 0 || is_zero_block(header, n)) {
+                return std::nullopt;
+            }
+            if (n < block_size) {
+                throw std::runtime_error("Unexpected end of the tar archive.");
+            }
+            if (!valid_checksum(header)) {
+                throw std::runtime_error("Invalid tar header. The input is probably not a tar archive.");
+            }
+
+            size_t size = parse_size(header + 124, 12);
+            char type = header[156];
+
+            if (type == 'x' || type == 'L') {
+                // pax extended header or GNU long name describing the following entry
+                std::string data = read_string(size);
+                if (type == 'L') {
+                    long_name = data.c_str();
+                } else {
+                    parse_pax(data, long_name, long_size);
+                }
+                continue;
+            }
+
+            TarEntry entry;
+            entry.size = long_size.value_or(size);
+            entry.regular = type == '0' || type == '\0' || type == '7';
+
+            if (!long_name.empty()) {
+                entry.name = long_name;
+            } else {
+                entry.name = field(header, 100);
+                if (std::memcmp(header + 257, "ustar", 5) == 0 && header[345] != '\0') {
+                    entry.name = field(header + 345, 155) + "/" + entry.name;
+                }
+            }
+
+            // links, devices, directories and fifos have no data, whatever their size says
+            bool has_data = std::strchr("123456", type) == nullptr || type == '\0';
+            size_t data_size = has_data ? entry.size : 0;
+            remaining_ = data_size;
+            padding_ = round_up(data_size) - data_size;
+
+            return entry;
+        }
+    }
+
+    /**
+     * Returns the next piece of the current entry's data,
+     * an empty chunk at its end.
+     */
+    Chunk data() {
+        Chunk piece = take(remaining_);
+        if (remaining_ > 0 && piece.size == 0) {
+            throw std::runtime_error("Unexpected end of the tar archive.");
+        }
+        remaining_ -= piece.size;
+        return piece;
+    }
+
+private:
+    /**
+     * Returns up to `max` bytes from the current chunk of the archive,
+     * an empty chunk only at the end of the archive.
+     */
+    Chunk take(size_t max) {
+        if (max == 0) {
+            return { chunk_.data, 0 };
+        }
+
+        if (chunk_.size == 0) {
+            chunk_ = archive_.next();
+        }
+
+        size_t n = std::min(max, chunk_.size);
+        Chunk piece = { chunk_.data, n };
+        chunk_.data += n;
+        chunk_.size -= n;
+
+        return piece;
+    }
+
+    size_t read(char* out, size_t size) {
+        size_t total = 0;
+        while (total < size) {
+            Chunk piece = take(size - total);
+            if (piece.size == 0) {
+                break;
+            }
+            std::memcpy(out + total, piece.data, piece.size);
+            total += piece.size;
+        }
+        return total;
+    }
+
+    std::string read_string(size_t size) {
+        std::string res(size, '\0');
+        if (read(res.data(), size) < size) {
+            throw std::runtime_error("Unexpected end of the tar archive.");
+        }
+        skip(round_up(size) - size);
+        return res;
+    }
+
+    void skip(size_t size) {
+        while (size > 0) {
+            Chunk piece = take(size);
+            if (piece.size == 0) {
+                throw std::runtime_error("Unexpected end of the tar archive.");
+            }
+            size -= piece.size;
+        }
+    }
+
+    static size_t round_up(size_t size) {
+        return (size + block_size - 1) / block_size * block_size;
+    }
+
+    static bool is_zero_block(const char* block, size_t size) {
+        return std::all_of(block, block + size, [](char c) { return c == '\0'; });
+    }
+
+    static bool valid_checksum(const char* header) {
+        // computed with the checksum field itself filled with spaces
+        size_t sum = 8 * ' ';
+        for (size_t i = 0; i < block_size; ++i) {
+            if (i < 148 || i >= 156) {
+                sum += uint8_t(header[i]);
+            }
+        }
+        return sum == parse_size(header + 148, 8);
+    }
+
+    static std::string field(const char* data, size_t size) {
+        return std::string(data, strnlen(data, size));
+    }
+
+    /**
+     * Parses a numeric field, either octal or, for large values,
+     * base-256 marked by the highest bit of the first byte.
+     */
+    static size_t parse_size(const char* data, size_t size) {
+        size_t res = 0;
+
+        if (data[0] & 0x80) {
+            for (size_t i = 1; i < size; ++i) {
+                res = (res << 8) | uint8_t(data[i]);
+            }
+            return res;
+        }
+
+        size_t i = 0;
+        while (i < size && data[i] == ' ') {
+            ++i;
+        }
+        for (; i < size && data[i] >= '0' && data[i] <= '7'; ++i) {
+            res = res*8 + (data[i] - '0');
+        }
+        return res;
+    }
+
+    /**
+     * Extracts the path and size from pax records of the form "<length> <key>=<value>\n".
+     */
+    static void parse_pax(std::string_view data, std::string& path, std::optional<size_t>& size) {
+        while (!data.empty()) {
+            size_t length = 0;
+            size_t i = 0;
+            for (; i < data.size() && data[i] >= '0' && data[i] <= '9'; ++i) {
+                length = length*10 + (data[i] - '0');
+            }
+            if (length < i + 2 || length > data.size()) {
+                throw std::runtime_error("Invalid pax header in the tar archive.");
+            }
+
+            std::string_view record = data.substr(i + 1, length - i - 2);
+            data.remove_prefix(length);
+
+            size_t eq = record.find('=');
+            if (eq == std::string_view::npos) {
+                continue;
+            }
+            std::string_view key = record.substr(0, eq);
+            std::string_view value = record.substr(eq + 1);
+
+            if (key == "path") {
+                path = value;
+            } else if (key == "size") {
+                size_t val = 0;
+                for (char c : value) {
+                    val = val*10 + (c - '0');
+                }
+                size = val;
+            }
+        }
+    }
+
+    InputSource& archive_;
+    Chunk chunk_ = { nullptr, 0 };
+
+    // of the current entry
+    size_t remaining_ = 0;
+    size_t padding_ = 0;
+};
+
+
+/**
+ * The data of the current entry of a tar archive as an input source.
+ */
+struct TarEntrySource : InputSource {
+
+    TarEntrySource(TarReader& reader, std::string archive_name)
+        : reader_(reader),
+          archive_name_(std::move(archive_name)) { }
+
+    Chunk next() override {
+        return reader_.data();
+    }
+
+    std::string name() const override {
+        return archive_name_ + ", tar";
+    }
+
+private:
+    TarReader& reader_;
+    std::string archive_name_;
+};
@@ -0,0 +1,430 @@
+#pragma once
+
+#include "source.hpp"
+#include "aligned_buffer.hpp"
+
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+
+/**
+ * Minimal io_uring instance which talks to the kernel through raw system
+ * calls, so there is no dependency on liburing.
+ */
+struct IoUring {
+
+    /**
+     * Creates a ring with room for `entries` submissions. Returns nullptr
+     * if io_uring isn't supported by the kernel or is disabled.
+     */
+    static std::unique_ptr<IoUring> create(unsigned entries) {
+#ifdef __NR_io_uring_setup
+        io_uring_params params;
+        std::memset(&params, 0, sizeof(params));
+
+        int fd = syscall(__NR_io_uring_setup, entries, &params);
+        if (fd < 0) {
+            return nullptr;
+        }
+
+        std::unique_ptr<IoUring> ring(new IoUring(fd));
+        if (!ring->map_rings(params)) {
+            return nullptr;
+        }
+        return ring;
+#else
+        (void) entries;
+        return nullptr;
+#endif
+    }
+
+    IoUring(const IoUring&) = delete;
+    IoUring& operator=(const IoUring&) = delete;
+
+    ~IoUring() {
+        if (sqes_) {
+            munmap(sqes_, sqes_size_);
+        }
+        if (cq_ring_ && cq_ring_ != sq_ring_) {
+            munmap(cq_ring_, cq_ring_size_);
+        }
+        if (sq_ring_) {
+            munmap(sq_ring_, sq_ring_size_);
+        }
+        ::close(fd_);
+    }
+
+    /**
+     * Registers the buffers so the kernel doesn't have to map them
+     * for every request. Returns false if the kernel refused,
+     * e.g. because of the locked memory limit.
+     */
+    bool register_buffers(const std::vector<iovec>& buffers) {
+        return syscall(__NR_io_uring_register, fd_, IORING_REGISTER_BUFFERS,
+                       buffers.data(), buffers.size()) == 0;
+    }
+
+    /**
+     * Returns an empty submission queue entry which is submitted
+     * by the next call to `submit`.
+     */
+    io_uring_sqe* get_sqe() {
+        unsigned tail = *sq_tail_ + pending_;
+        unsigned index = tail & *sq_mask_;
+
+        io_uring_sqe* sqe = &sqes_[index];
+        std::memset(sqe, 0, sizeof(*sqe));
+        sq_array_[index] = index;
+
+        ++pending_;
+        return sqe;
+    }
+
+    void submit() {
+        if (pending_ == 0) {
+            return;
+        }
+
+        __atomic_store_n(sq_tail_, *sq_tail_ + pending_, __ATOMIC_RELEASE);
+
+        unsigned to_submit = pending_;
+        pending_ = 0;
+
+        while (to_submit > 0) {
+            int res = syscall(__NR_io_uring_enter, fd_, to_submit, 0, 0, nullptr, 0);
+            if (res < 0) {
+                if (errno == EINTR || errno == EAGAIN) {
+                    continue;
+                }
+                throw std::runtime_error(std::string("io_uring submission failed: ") + std::strerror(errno));
+            }
+            to_submit -= res;
+        }
+    }
+
+    /**
+     * Blocks until a request completes and returns its completion entry.
+     */
+    io_uring_cqe wait_cqe() {
+        io_uring_cqe cqe;
+        if (!try_wait_cqe(cqe)) {
+            throw std::runtime_error(std::string("Waiting for io_uring failed: ") + std::strerror(errno));
+        }
+        return cqe;
+    }
+
+    /**
+     * Like `wait_cqe`, but returns false with errno set instead of throwing.
+     */
+    bool try_wait_cqe(io_uring_cqe& cqe) noexcept {
+        while (true) {
+            unsigned head = *cq_head_;
+            if (head != __atomic_load_n(cq_tail_, __ATOMIC_ACQUIRE)) {
+                cqe = cqes_[head & *cq_mask_];
+                __atomic_store_n(cq_head_, head + 1, __ATOMIC_RELEASE);
+                return true;
+            }
+
+            int res = syscall(__NR_io_uring_enter, fd_, 0, 1, IORING_ENTER_GETEVENTS, nullptr, 0);
+            if (res < 0 && errno != EINTR) {
+                return false;
+            }
+        }
+    }
+
+private:
+    IoUring(int fd) : fd_(fd) { }
+
+    bool map_rings(const io_uring_params& params) {
+        sq_ring_size_ = params.sq_off.array + params.sq_entries*sizeof(unsigned);
+        cq_ring_size_ = params.cq_off.cqes + params.cq_entries*sizeof(io_uring_cqe);
+
+        bool single_mmap = params.features & IORING_FEAT_SINGLE_MMAP;
+        if (single_mmap) {
+            sq_ring_size_ = cq_ring_size_ = std::max(sq_ring_size_, cq_ring_size_);
+        }
+
+        sq_ring_ = map(sq_ring_size_, IORING_OFF_SQ_RING);
+        if (!sq_ring_) {
+            return false;
+        }
+
+        cq_ring_ = single_mmap ? sq_ring_ : map(cq_ring_size_, IORING_OFF_CQ_RING);
+        if (!cq_ring_) {
+            return false;
+        }
+
+        sqes_size_ = params.sq_entries*sizeof(io_uring_sqe);
+        sqes_ = static_cast<io_uring_sqe*>(map(sqes_size_, IORING_OFF_SQES));
+        if (!sqes_) {
+            return false;
+        }
+
+        char* sq = static_cast<char*>(sq_ring_);
+        sq_tail_ = reinterpret_cast<unsigned*>(sq + params.sq_off.tail);
+        sq_mask_ = reinterpret_cast<unsigned*>(sq + params.sq_off.ring_mask);
+        sq_array_ = reinterpret_cast<unsigned*>(sq + params.sq_off.array);
+
+        char* cq = static_cast<char*>(cq_ring_);
+        cq_head_ = reinterpret_cast<unsigned*>(cq + params.cq_off.head);
+        cq_tail_ = reinterpret_cast<unsigned*>(cq + params.cq_off.tail);
+        cq_mask_ = reinterpret_cast<unsigned*>(cq + params.cq_off.ring_mask);
+        cqes_ = reinterpret_cast<io_uring_cqe*>(cq + params.cq_off.cqes);
+
+        return true;
+    }
+
+    void* map(size_t size, off_t offset) {
+        void* addr = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd_, offset);
+        return addr == MAP_FAILED ? nullptr : addr;
+    }
+
+    int fd_;
+
+    void* sq_ring_ = nullptr;
+    void* cq_ring_ = nullptr;
+    io_uring_sqe* sqes_ = nullptr;
+    size_t sq_ring_size_ = 0;
+    size_t cq_ring_size_ = 0;
+    size_t sqes_size_ = 0;
+
+    unsigned* sq_tail_;
+    unsigned* sq_mask_;
+    unsigned* sq_array_;
+    unsigned pending_ = 0;
+
+    unsigned* cq_head_;
+    unsigned* cq_tail_;
+    unsigned* cq_mask_;
+    io_uring_cqe* cqes_;
+};
+
+
+/**
+ * Reads a regular file with io_uring, keeping several large reads in flight.
+ *
+ * The file is split into blocks which are read into a fixed set of buffers,
+ * registered with the kernel if possible. Block `i` always goes into buffer
+ * `i % depth`, so the blocks are handed out in order even though the reads
+ * can complete in any order. A buffer is reused for the next block as soon
+ * as the consumer asks for the following chunk.
+ *
+ * With `direct` set the file is opened with O_DIRECT, so the reads bypass
+ * the page cache. The buffers and the block size are aligned to 4096 bytes,
+ * which keeps every read aligned as direct I/O requires.
+ */
+struct UringSource : InputSource {
+
+    static constexpr size_t default_depth = 4;
+    static constexpr size_t default_block_size = 1 << 22;
+
+    /**
+     * Opens the file at `path`. Returns nullptr if it isn't a regular file
+     * or if io_uring isn't available.
+     */
+    static std::unique_ptr<UringSource> open(const std::string& path,
+                                             bool direct = false,
+                                             size_t depth = default_depth,
+                                             size_t block_size = default_block_size)
+    {
+        int fd = ::open(path.c_str(), direct ? O_RDONLY | O_DIRECT : O_RDONLY);
+        if (fd < 0) {
+            return nullptr;
+        }
+
+        struct stat st;
+        if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode)) {
+            ::close(fd);
+            return nullptr;
+        }
+
+        auto ring = IoUring::create(depth);
+        if (!ring) {
+            ::close(fd);
+            return nullptr;
+        }
+
+        return std::unique_ptr<UringSource>(new UringSource(fd, st.st_size, std::move(ring), direct, depth, block_size));
+    }
+
+    ~UringSource() {
+        // the kernel might still be writing into the buffers, so the reads
+        // in flight are waited for, but neither retried nor checked
+        size_t in_flight = std::count_if(slots_.begin(), slots_.end(), [](const Slot& slot) {
+            return slot.in_flight;
+        });
+
+        io_uring_cqe cqe;
+        while (in_flight > 0 && ring_ && ring_->try_wait_cqe(cqe)) {
+            Slot& slot = slots_[cqe.user_data];
+            if (slot.in_flight) {
+                slot.in_flight = false;
+                --in_flight;
+            }
+        }
+
+        // the ring goes first, so anything left is cancelled before the buffers go away
+        ring_.reset();
+        ::close(fd_);
+    }
+
+    Chunk next() override {
+        if (holding_) {
+            holding_ = false;
+            size_t slot = (next_block_ - 1) % slots_.size();
+            size_t block = next_block_ - 1 + slots_.size();
+            if (block < block_count_) {
+                submit_read(slot, block);
+                ring_->submit();
+            }
+        }
+
+        if (next_block_ == block_count_) {
+            return { nullptr, 0 };
+        }
+
+        Slot& slot = slots_[next_block_ % slots_.size()];
+        while (slot.in_flight) {
+            handle(ring_->wait_cqe());
+        }
+
+        holding_ = true;
+        ++next_block_;
+
+        return { slot.buffer.data(), slot.size };
+    }
+
+    std::string name() const override {
+        if (direct_) {
+            return registered_ ? "io_uring (O_DIRECT, registered buffers)" : "io_uring (O_DIRECT)";
+        }
+        return registered_ ? "io_uring (registered buffers)" : "io_uring";
+    }
+
+private:
+    struct Slot {
+        Slot(size_t size) : buffer(size) { }
+
+        AlignedBuffer buffer;
+        size_t offset = 0;
+        size_t size = 0;
+        size_t done = 0; // bytes of the block which are already read
+        size_t start = 0; // where the read in flight starts
+        bool in_flight = false;
+    };
+
+    UringSource(int fd, size_t file_size, std::unique_ptr<IoUring> ring, bool direct, size_t depth, size_t block_size)
+        : fd_(fd),
+          direct_(direct),
+          file_size_(file_size),
+          block_size_(block_size),
+          block_count_((file_size + block_size - 1)/block_size),
+          ring_(std::move(ring))
+    {
+        std::vector<iovec> buffers;
+        slots_.reserve(depth);
+        for (size_t i = 0; i < depth; ++i) {
+            slots_.emplace_back(block_size);
+            buffers.push_back({ slots_.back().buffer.data(), block_size });
+        }
+
+        registered_ = ring_->register_buffers(buffers);
+
+        for (size_t i = 0; i < depth && i < block_count_; ++i) {
+            submit_read(i, i);
+        }
+        ring_->submit();
+    }
+
+    void submit_read(size_t slot_index, size_t block) {
+        Slot& slot = slots_[slot_index];
+        slot.offset = block*block_size_;
+        slot.size = std::min(block_size_, file_size_ - slot.offset);
+        slot.done = 0;
+        slot.in_flight = true;
+        queue_read(slot_index);
+    }
+
+    void queue_read(size_t slot_index) {
+        Slot& slot = slots_[slot_index];
+
+        // direct reads have to start and end on an aligned offset, rereading
+        // a part of the block after a short read doesn't hurt
+        size_t start = slot.done;
+        size_t end = slot.size;
+        if (direct_) {
+            start = start/alignment*alignment;
+            end = std::min(slot.buffer.size(), (end + alignment - 1)/alignment*alignment);
+        }
+
+        io_uring_sqe* sqe = ring_->get_sqe();
+        sqe->opcode = registered_ ? IORING_OP_READ_FIXED : IORING_OP_READ;
+        sqe->fd = fd_;
+        sqe->off = slot.offset + start;
+        sqe->addr = reinterpret_cast<uint64_t>(slot.buffer.data() + start);
+        sqe->len = end - start;
+        slot.start = start;
+        sqe->buf_index = registered_ ? slot_index : 0;
+        sqe->user_data = slot_index;
+    }
+
+    void handle(const io_uring_cqe& cqe) {
+        size_t slot_index = cqe.user_data;
+        Slot& slot = slots_[slot_index];
+
+        if (cqe.res == -EAGAIN || cqe.res == -EINTR) {
+            queue_read(slot_index);
+            ring_->submit();
+            return;
+        }
+
+        if (cqe.res < 0) {
+            slot.in_flight = false;
+            throw std::runtime_error(std::string("Failed to read the input: ") + std::strerror(-cqe.res));
+        }
+
+        if (cqe.res == 0) {
+            slot.in_flight = false;
+            throw std::runtime_error("The input file was truncated while being read.");
+        }
+
+        slot.done = slot.start + cqe.res;
+
+        if (slot.done < slot.size) {
+            // short read, ask for the rest
+            queue_read(slot_index);
+            ring_->submit();
+            return;
+        }
+
+        slot.in_flight = false;
+    }
+
+    static constexpr size_t alignment = 4096;
+
+    int fd_;
+    bool direct_;
+    size_t file_size_;
+    size_t block_size_;
+    size_t block_count_;
+
+    std::unique_ptr<IoUring> ring_;
+    std::vector<Slot> slots_;
+    bool registered_ = false;
+
+    size_t next_block_ = 0;
+    bool holding_ = false;
+};
@@ -0,0 +1,224 @@
+#pragma once
+
+#include "mapped_file.hpp"
+#include "inflate.hpp"
+
+#include <cstdint>
+#include <cstring>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+
+/**
+ * A member of a zip archive.
+ */
+struct ZipEntry {
+    std::string name;
+    uint16_t method;            // 0 for stored, 8 for deflated
+    size_t compressed_size;
+    size_t size;
+    size_t header_offset;       // of the local file header
+};
+
+
+/**
+ * Read-only access to the members of a memory mapped zip archive,
+ * including zip64 archives.
+ *
+ * Stored members are handed out directly from the mapping, deflated
+ * ones are decompressed into memory on demand.
+ */
+struct ZipArchive {
+
+    /**
+     * Maps the archive at `path` and reads its central directory.
+     * Throws std::runtime_error if it isn't a valid zip archive.
+     */
+    explicit ZipArchive(const std::string& path) : file_(MappedFile::open_or_throw(path)) {
+        read_central_directory();
+    }
+
+    size_t size() const {
+        return file_.size();
+    }
+
+    const std::vector<ZipEntry>& entries() const {
+        return entries_;
+    }
+
+    const ZipEntry* find(const std::string& name) const {
+        for (const auto& entry : entries_) {
+            if (entry.name == name) {
+                return &entry;
+            }
+        }
+        return nullptr;
+    }
+
+    /**
+     * Returns the uncompressed data of `entry`. Stored data points
+     * into the mapping, deflated data is decompressed into `buffer`.
+     */
+    Chunk read(const ZipEntry& entry, std::vector<char>& buffer) const {
+        const char* data = file_.data();
+        size_t size = file_.size();
+
+        if (entry.header_offset > size || size - entry.header_offset < local_header_size
+                || u32(data + entry.header_offset) != local_header_signature) {
+            corrupted();
+        }
+
+        const char* header = data + entry.header_offset;
+        size_t offset = entry.header_offset + local_header_size + u16(header + 26) + u16(header + 28);
+        if (offset > size || entry.compressed_size > size - offset) {
+            corrupted();
+        }
+
+        if (entry.method == 0) {
+            if (entry.compressed_size != entry.size) {
+                corrupted();
+            }
+            return { data + offset, entry.size };
+        }
+
+        if (entry.method != 8) {
+            throw std::runtime_error("Unsupported compression method of '" + entry.name + "' in the zip archive.");
+        }
+
+        Chunk compressed = { data + offset, entry.compressed_size };
+        BitReader input([&compressed] { return std::exchange(compressed, Chunk{ nullptr, 0 }); });
+        Inflater inflater(input);
+
+        char dummy;
+        buffer.resize(entry.size);
+        if (inflater.read(buffer.data(), entry.size) != entry.size || inflater.read(&dummy, 1) != 0) {
+            corrupted();
+        }
+
+        return { buffer.data(), buffer.size() };
+    }
+
+private:
+    static constexpr uint32_t local_header_signature = 0x04034b50;
+    static constexpr uint32_t central_header_signature = 0x02014b50;
+    static constexpr uint32_t end_signature = 0x06054b50;
+    static constexpr uint32_t zip64_end_signature = 0x06064b50;
+    static constexpr uint32_t zip64_locator_signature = 0x07064b50;
+
+    static constexpr size_t local_header_size = 30;
+    static constexpr size_t central_header_size = 46;
+    static constexpr size_t end_size = 22;
+
+    [[noreturn]] static void corrupted() {
+        throw std::runtime_error("The zip archive is corrupted.");
+    }
+
+    static uint16_t u16(const char* p) {
+        return uint8_t(p[0]) | uint8_t(p[1]) << 8;
+    }
+
+    static uint32_t u32(const char* p) {
+        return uint32_t(u16(p)) | uint32_t(u16(p + 2)) << 16;
+    }
+
+    static uint64_t u64(const char* p) {
+        return uint64_t(u32(p)) | uint64_t(u32(p + 4)) << 32;
+    }
+
+    void read_central_directory() {
+        const char* data = file_.data();
+        size_t size = file_.size();
+
+        // the end record is followed only by a comment of at most 64 KB
+        if (size < end_size) {
+            throw std::runtime_error("The input is not a zip archive.");
+        }
+        size_t end = size - end_size;
+        size_t lowest = size > end_size + 0xFFFF ? size - end_size - 0xFFFF : 0;
+        while (u32(data + end) != end_signature) {
+            if (end == lowest) {
+                throw std::runtime_error("The input is not a zip archive.");
+            }
+            --end;
+        }
+
+        size_t count = u16(data + end + 10);
+        size_t directory_offset = u32(data + end + 16);
+
+        // zip64 moves the counts and offsets into another record, found through a locator
+        if (end >= 20 && u32(data + end - 20) == zip64_locator_signature) {
+            size_t record = u64(data + end - 20 + 8);
+            if (record > size - 56 || u32(data + record) != zip64_end_signature) {
+                corrupted();
+            }
+            count = u64(data + record + 32);
+            directory_offset = u64(data + record + 48);
+        }
+
+        size_t pos = directory_offset;
+        for (size_t i = 0; i < count; ++i) {
+            if (pos > size || size - pos < central_header_size || u32(data + pos) != central_header_signature) {
+                corrupted();
+            }
+
+            const char* header = data + pos;
+            size_t name_size = u16(header + 28);
+            size_t extra_size = u16(header + 30);
+            size_t comment_size = u16(header + 32);
+            if (size - pos - central_header_size < name_size + extra_size + comment_size) {
+                corrupted();
+            }
+
+            ZipEntry entry;
+            entry.method = u16(header + 10);
+            entry.compressed_size = u32(header + 20);
+            entry.size = u32(header + 24);
+            entry.header_offset = u32(header + 42);
+            entry.name.assign(header + central_header_size, name_size);
+
+            read_zip64_extra(header + central_header_size + name_size, extra_size, entry);
+
+            entries_.push_back(std::move(entry));
+            pos += central_header_size + name_size + extra_size + comment_size;
+        }
+    }
+
+    /**
+     * Values that don't fit into 32 bits are saturated in the header
+     * and stored in the zip64 extra field, in a fixed order.
+     */
+    static void read_zip64_extra(const char* extra, size_t size, ZipEntry& entry) {
+        constexpr uint32_t saturated = 0xFFFFFFFF;
+
+        size_t pos = 0;
+        while (size - pos >= 4) {
+            uint16_t id = u16(extra + pos);
+            size_t field_size = u16(extra + pos + 2);
+            if (size - pos - 4 < field_size) {
+                corrupted();
+            }
+
+            if (id == 0x0001) {
+                const char* field = extra + pos + 4;
+                const char* field_end = field + field_size;
+                for (size_t* val : { &entry.size, &entry.compressed_size, &entry.header_offset }) {
+                    if (*val == saturated) {
+                        if (field_end - field < 8) {
+                            corrupted();
+                        }
+                        *val = u64(field);
+                        field += 8;
+                    }
+                }
+            }
+
+            pos += 4 + field_size;
+        }
+    }
+
+    MappedFile file_;
+    std::vector<ZipEntry> entries_;
+};
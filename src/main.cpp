@@ -1,3 +1,6 @@
+#include <algorithm>
+#include <chrono>
+#include <filesystem>
 #include <iostream>
 #include <sstream>
 #include <fstream>
@@ -6,8 +9,22 @@
 #include <vector>
 #include <string_view>
 #include <map>
+#include <memory>
+#include <type_traits>
 
 #include "parsing/parser.hpp"
+#include "parsing/array.hpp"
+#include "parsing/binary.hpp"
+#include "parsing/edge_list.hpp"
+#include "parsing/npy.hpp"
+#include "parsing/rutherford_boeing.hpp"
+#include "input/mapped_file.hpp"
+#include "input/stream.hpp"
+#include "input/pipeline.hpp"
+#include "input/uring.hpp"
+#include "input/gzip.hpp"
+#include "input/bgzf.hpp"
+#include "input/tar.hpp"
 
 #include "utils.hpp"
 #include "types.hpp"
@@ -20,7 +37,26 @@
 #include "drawing/svg.hpp"
 
 void print_parsing_error(const Status& status) {
-    std::cerr << "Error:" << status.line << ":" << status.col << ": " << status.error_message << "\n";
+    std::cerr << "Error:" << status.line << ":" << status.col << ": " << status.error_message;
+    if (status.found[0] != '\0') {
+        std::cerr << " Found '" << status.found << "'.";
+    }
+    std::cerr << "\n";
+}
+
+void print_input_info(const std::string& backend) {
+    std::cout << "Input parameters:\n";
+    std::cout << "    backend:     " << backend << "\n";
+    std::cout << "    scan kernel: " << scan_kernel().name << "\n";
+    std::cout << "\n";
+}
+
+void print_input_stats(size_t bytes, double seconds) {
+    std::cout << "Input statistics:\n";
+    std::cout << "    bytes read: " << bytes << "\n";
+    std::cout << "    time:       " << seconds << " s\n";
+    std::cout << "    throughput: " << bytes/seconds/1e9 << " GB/s\n";
+    std::cout << "\n";
 }
 
 void print_matrix_info(const Header& header) {
@@ -78,16 +114,18 @@ ImageConfig init_image_config(const Header& header, const CmdOptions& opts) {
     }
 
     config.adjust_colors = opts.adjust_colors;
+    config.color_mode = opts.color_mode;
     config.format = opts.image_format;
 
     return config;
 }
 
-Grid make_grid(const Header& header, const ImageConfig& config, const CmdOptions& opts) {
+template<typename GridType>
+GridType make_grid(const Header& header, const ImageConfig& config, const CmdOptions& opts) {
     size_t max_blocks_x = (config.viewport_width - 2*config.border_size) / config.block_size;
     size_t max_blocks_y = (config.viewport_height - 2*config.border_size) / config.block_size;
 
-    Grid grid(header, max_blocks_y, max_blocks_x);
+    GridType grid(header, max_blocks_y, max_blocks_x, opts.pow2_blocks);
 
     if (opts.verbose) {
         std::cout << "Grid parameters:\n";
@@ -95,6 +133,7 @@ Grid make_grid(const Header& header, const ImageConfig& config, const CmdOptions
         std::cout << "    cols:           " << grid.cols() << "\n";
         std::cout << "    block size:     " << grid.block_size() << "\n";
         std::cout << "    block capacity: " << grid.block_capacity() << "\n";
+        std::cout << "    storage:        " << (grid.tiled() ? "tiled" : "dense") << "\n";
         std::cout << "\n";
     }
 
@@ -102,7 +141,8 @@ Grid make_grid(const Header& header, const ImageConfig& config, const CmdOptions
 }
 
 
-void draw_grid(const Grid& grid, ImageConfig& image_config, const CmdOptions& opts) {
+template<typename GridType>
+void draw_grid(const GridType& grid, ImageConfig& image_config, const CmdOptions& opts) {
     image_config.width = grid.cols() * image_config.block_size + 2*image_config.border_size;
     image_config.height = grid.rows() * image_config.block_size + 2*image_config.border_size;
 
@@ -113,6 +153,7 @@ void draw_grid(const Grid& grid, ImageConfig& image_config, const CmdOptions& op
         std::cout << "   width:         " << image_config.width << "\n";
         std::cout << "   height:        " << image_config.height << "\n";
         std::cout << "   adjust colors: " << (image_config.adjust_colors ? "on" : "off") << "\n";
+        std::cout << "   color by:      " << color_mode_name(image_config.color_mode) << "\n";
         std::cout << "\n";
     }
 
@@ -126,53 +167,431 @@ void draw_grid(const Grid& grid, ImageConfig& image_config, const CmdOptions& op
 }
 
 
-int main(int argc, char** argv) {
-    std::optional<CmdOptions> opts = parse_args(argc, argv);
+// large enough to drain a whole enlarged pipe in one read
+constexpr size_t stdin_buffer_size = 1 << 20;
+
+std::unique_ptr<InputSource> open_input(const CmdOptions& opts) {
+    if (!opts.input_filename) {
+        // standard input redirected from a file can be mapped like any other file
+        if (!opts.no_cache && (opts.io == IoBackend::mmap || (opts.io == IoBackend::automatic && !opts.pipeline))) {
+            if (auto file = MappedFile::map(STDIN_FILENO)) {
+                off_t offset = lseek(STDIN_FILENO, 0, SEEK_CUR);
+                size_t start = std::min<size_t>(offset > 0 ? offset : 0, file->size());
+                // compressed input is read below, mapping doesn't move the descriptor's offset
+                if (!has_gzip_magic(std::string_view(file->data() + start, file->size() - start))) {
+                    return std::make_unique<MappedSource>(std::move(*file), start);
+                }
+            }
+        }
+
+        auto reader = std::make_unique<PrefixedReader>(FileReader::from_fd(STDIN_FILENO), 2);
+        if (has_gzip_magic(reader->prefix())) {
+            return std::make_unique<PipelinedSource>(std::make_unique<GzipReader>(std::move(reader)));
+        }
+        if (opts.pipeline) {
+            return std::make_unique<PipelinedSource>(std::move(reader));
+        }
+        return std::make_unique<BufferedSource>(std::move(reader), stdin_buffer_size);
+    }
 
-    if (!opts) {
+    const std::string& path = opts.input_filename.value();
+
+    // decompression always runs on other threads to overlap with parsing
+    if (is_gzip_file(path)) {
+        if (auto source = ParallelGzipSource::open(path, opts.threads, opts.no_cache)) {
+            return source;
+        }
+
+        std::unique_ptr<Reader> reader = FileReader::open(path, opts.no_cache);
+        if (!reader) {
+            reader = std::make_unique<StreamReader>(path);
+        }
+        return std::make_unique<PipelinedSource>(std::make_unique<GzipReader>(std::move(reader)));
+    }
+
+    if (opts.io == IoBackend::uring) {
+        if (auto source = UringSource::open(path, opts.no_cache)) {
+            return source;
+        }
+    } else if (!opts.no_cache && (opts.io == IoBackend::mmap || (opts.io == IoBackend::automatic && !opts.pipeline))) {
+        if (auto file = MappedFile::open(path)) {
+            return std::make_unique<MappedSource>(std::move(*file));
+        }
+    }
+
+    std::unique_ptr<Reader> reader = FileReader::open(path, opts.no_cache);
+    if (!reader) {
+        // reading from the stream fails and the header parser reports it
+        reader = std::make_unique<StreamReader>(path);
+    }
+
+    if (opts.pipeline) {
+        return std::make_unique<PipelinedSource>(std::move(reader));
+    }
+    return std::make_unique<BufferedSource>(std::move(reader));
+}
+
+
+/**
+ * Reads the entries of a matrix with the given header and draws the image.
+ *
+ * The entries are read by `read(grid, bytes_read)`, which fills the grid,
+ * sets the number of input bytes it went through and returns the status
+ * of parsing. Only a `ValueGrid` gets the values of the entries.
+ */
+template<typename GridType = Grid, typename EntryReader>
+int render(const Header& header, const std::string& backend, const EntryReader& read, const CmdOptions& opts) {
+    if (opts.color_mode != ColorMode::count && !std::is_same_v<GridType, ValueGrid>) {
+        std::cerr << "Coloring by values is supported only for Matrix Market files in the coordinate format.\n";
         return EXIT_FAILURE;
     }
 
-    std::optional<std::ifstream> input_file;
-    if (opts->input_filename) {
-        input_file = std::ifstream(opts->input_filename.value());
-    } else {
-        std::ios_base::sync_with_stdio(false);
-        std::cin.tie(0);
+    auto start_time = std::chrono::steady_clock::now();
+
+    if (opts.verbose) {
+        print_input_info(backend);
+        print_matrix_info(header);
     }
 
-    std::istream& input = input_file ? *input_file : std::cin;
+    ImageConfig image_config = init_image_config(header, opts);
+    GridType grid = make_grid<GridType>(header, image_config, opts);
 
-    Header header;
-    auto status = parse_header(input, header);
+    size_t bytes_read = 0;
+    auto status = read(grid, bytes_read);
     if (!status) {
         print_parsing_error(status);
         return EXIT_FAILURE;
     }
+    grid.flush();
 
-    if (header.format == Format::array) {
-        std::cerr << "Array format is not supported. Only sparse matrices (coordinate format) are supported.\n";
+    if (opts.verbose) {
+        std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start_time;
+        print_input_stats(bytes_read, elapsed.count());
+        std::cout << "Entries processed: " << grid.entries() << "\n";
+        if (grid.tiled()) {
+            std::cout << "Blocks allocated:  " << grid.allocated_blocks() << " of " << grid.rows()*grid.cols() << "\n";
+        }
+        std::cout << "\n";
+    }
+
+    draw_grid(grid, image_config, opts);
+
+    return EXIT_SUCCESS;
+}
+
+/**
+ * Reads the entries following the already parsed header and draws the image.
+ */
+int render(SourceBuf& input_buf, const Header& header, const CmdOptions& opts) {
+    auto read = [&](Grid& grid, size_t& bytes_read) {
+        auto status = header.format == Format::array
+            ? read_array_entries(input_buf, header, grid)
+            : read_entries(input_buf, header, grid, opts.threads);
+        bytes_read = input_buf.bytes_read();
+        return status;
+    };
+
+    if (opts.color_mode != ColorMode::count && header.format == Format::coordinate) {
+        auto read_values = [&](ValueGrid& grid, size_t& bytes_read) {
+            auto status = read_entries(input_buf, header, grid, opts.threads);
+            bytes_read = input_buf.bytes_read();
+            return status;
+        };
+        return render<ValueGrid>(header, input_buf.source().name(), read_values, opts);
+    }
+
+    return render(header, input_buf.source().name(), read, opts);
+}
+
+
+/**
+ * The image of an archive member is named after it, e.g. 'bcsstk01/bcsstk01.mtx'
+ * is drawn into '<output dir>/bcsstk01.png'.
+ */
+std::string member_output_path(const std::string& member_name, const CmdOptions& opts) {
+    std::string name = member_name.substr(member_name.find_last_of('/') + 1);
+    if (ends_with(name, ".mtx")) {
+        name.resize(name.size() - 4);
+    }
+    name += get_image_extension(opts.image_format);
+
+    if (!opts.output_filename) {
+        return name;
+    }
+    std::filesystem::create_directories(*opts.output_filename);
+    return *opts.output_filename + "/" + name;
+}
+
+/**
+ * Whether data starting with `chunk` can be a Matrix Market file. A banner
+ * cut short by the end of the chunk is compared as far as it goes.
+ */
+bool starts_with_banner(Chunk chunk) {
+    constexpr std::string_view banner = "%%MatrixMarket";
+    size_t size = std::min(chunk.size, banner.size());
+    return size > 0 && std::string_view(chunk.data, size) == banner.substr(0, size);
+}
+
+/**
+ * Renders every matrix in a tar archive.
+ *
+ * Members are recognized as matrices by their header, everything else is skipped.
+ * Members which don't even start with the banner are skipped before their header
+ * is parsed, so a large binary member isn't read looking for the end of its first line.
+ */
+int render_archive(InputSource& archive, const CmdOptions& opts) {
+    TarReader tar(archive);
+    TarEntrySource member(tar, archive.name());
+
+    int res = EXIT_SUCCESS;
+    size_t rendered = 0;
+
+    while (auto entry = tar.next()) {
+        if (!entry->regular) {
+            continue;
+        }
+
+        SourceBuf input_buf(member);
+        if (!starts_with_banner(input_buf.peek())) {
+            if (opts.verbose) {
+                std::cout << "Skipping " << entry->name << "\n\n";
+            }
+            continue;
+        }
+
+        std::istream input(&input_buf);
+        input.exceptions(std::ios::badbit);
+
+        Header header;
+        if (!parse_header(input, header)) {
+            if (opts.verbose) {
+                std::cout << "Skipping " << entry->name << "\n\n";
+            }
+            continue;
+        }
+
+        if (opts.verbose) {
+            std::cout << "Rendering " << entry->name << "\n\n";
+        }
+
+        CmdOptions member_opts = opts;
+        member_opts.output_filename = member_output_path(entry->name, opts);
+
+        if (render(input_buf, header, member_opts) != EXIT_SUCCESS) {
+            std::cerr << "Failed to render " << entry->name << ".\n";
+            res = EXIT_FAILURE;
+        }
+        ++rendered;
+    }
+
+    if (rendered == 0) {
+        std::cerr << "No matrices found in the archive.\n";
         return EXIT_FAILURE;
     }
 
-    if (opts->verbose) {
-        print_matrix_info(header);
+    return res;
+}
+
+
+/**
+ * Renders a graph given by a text edge list. Unless the size is given,
+ * it is found by a first pass over the whole list, for which the input
+ * is opened once more.
+ */
+int render_edge_list(std::unique_ptr<InputSource> source, const CmdOptions& opts) {
+    Header header = edge_list_header(-1, 0);
+
+    if (opts.dims) {
+        header.rows = opts.dims->first;
+        header.cols = opts.dims->second;
+    } else {
+        if (!opts.input_filename) {
+            std::cerr << "The size of an edge list on the standard input has to be given by --dims.\n";
+            return EXIT_FAILURE;
+        }
+
+        SourceBuf input_buf(*source);
+        EdgeListBounds bounds;
+        auto status = read_entries(input_buf, header, bounds, opts.threads);
+        if (!status) {
+            print_parsing_error(status);
+            return EXIT_FAILURE;
+        }
+
+        header = edge_list_header(bounds.nodes, bounds.edges);
+        source = open_input(opts);
+    }
+
+    SourceBuf input_buf(*source);
+    return render(input_buf, header, opts);
+}
+
+
+int run(const CmdOptions& opts) {
+    if (opts.input_filename && ends_with(*opts.input_filename, ".npz")) {
+        NpzMatrix matrix(*opts.input_filename);
+        auto read = [&](Grid& grid, size_t& bytes_read) {
+            matrix.read_entries(grid);
+            bytes_read = matrix.size();
+            return Status::success();
+        };
+        return render(matrix.header(), "mmap, npz (" + matrix.format() + ")", read, opts);
+    }
+
+    if (opts.input_filename && ends_with(*opts.input_filename, ".npy")) {
+        if (auto prefix = NpyMatrix::member_prefix(*opts.input_filename)) {
+            NpyMatrix matrix(*prefix);
+            auto read = [&](Grid& grid, size_t& bytes_read) {
+                matrix.read_entries(grid);
+                bytes_read = matrix.size();
+                return Status::success();
+            };
+            return render(matrix.header(), "mmap, npy (" + matrix.format() + ")", read, opts);
+        }
+
+        NpyCoordinates matrix(*opts.input_filename);
+        auto read = [&](Grid& grid, size_t& bytes_read) {
+            matrix.read_entries(grid);
+            bytes_read = matrix.size();
+            return Status::success();
+        };
+        return render(matrix.header(), "mmap, npy", read, opts);
+    }
+
+    if (opts.input_filename && is_binary_matrix_file(*opts.input_filename)) {
+        BinaryMatrix matrix(*opts.input_filename);
+        auto read = [&](Grid& grid, size_t& bytes_read) {
+            read_binary_entries(matrix, grid, opts.threads);
+            bytes_read = matrix.size();
+            return Status::success();
+        };
+        return render(matrix.header(), "mmap, binary", read, opts);
+    }
+
+    if (opts.input_filename && (ends_with(*opts.input_filename, ".sg") || ends_with(*opts.input_filename, ".wsg"))) {
+        GapGraph graph(*opts.input_filename);
+        auto read = [&](Grid& grid, size_t& bytes_read) {
+            graph.read_entries(grid);
+            bytes_read = graph.size();
+            return Status::success();
+        };
+        return render(graph.header(), "mmap, gap graph", read, opts);
     }
 
-    ImageConfig image_config = init_image_config(header, *opts);
-    Grid grid = make_grid(header, image_config, *opts);
+    std::unique_ptr<InputSource> source = open_input(opts);
 
-    status = read_entries_custom(input, header, grid);
+    if (opts.tar) {
+        return render_archive(*source, opts);
+    }
+
+    if (opts.edge_list) {
+        return render_edge_list(std::move(source), opts);
+    }
+
+    SourceBuf input_buf(*source);
+    std::istream input(&input_buf);
+    // rethrows errors of the input source instead of just setting the badbit
+    input.exceptions(std::ios::badbit);
+
+    if (opts.input_filename && is_rutherford_boeing_path(*opts.input_filename)) {
+        RbHeader rb;
+        auto status = parse_rb_header(input, rb);
+        if (!status) {
+            print_parsing_error(status);
+            return EXIT_FAILURE;
+        }
+
+        auto read = [&](Grid& grid, size_t& bytes_read) {
+            auto status = read_rb_entries(input, rb, grid);
+            bytes_read = input_buf.bytes_read();
+            return status;
+        };
+        return render(rb.header, source->name() + ", rutherford-boeing", read, opts);
+    }
+
+    Header header;
+    auto status = parse_header(input, header);
     if (!status) {
         print_parsing_error(status);
         return EXIT_FAILURE;
     }
 
-    if (opts->verbose) {
-        std::cout << "Entries processed: " << grid.entries() << "\n\n";
+    return render(input_buf, header, opts);
+}
+
+
+/**
+ * Converts a Matrix Market file into the binary format.
+ */
+int convert(const ConvertOptions& convert_opts) {
+    CmdOptions opts;
+    opts.input_filename = convert_opts.input_filename;
+
+    std::unique_ptr<InputSource> source = open_input(opts);
+    SourceBuf input_buf(*source);
+    std::istream input(&input_buf);
+    input.exceptions(std::ios::badbit);
+
+    Header header;
+    auto status = parse_header(input, header);
+    if (!status) {
+        print_parsing_error(status);
+        return EXIT_FAILURE;
+    }
+
+    // dense matrices are stored as their nonzero entries, at most all of them
+    size_t max_entries = header.format == Format::array ? header.rows*header.cols : header.entries;
+    BinaryWriter writer(convert_opts.output_filename, header, max_entries);
+
+    // only the stored entries are kept, mirroring is up to the reader
+    EntryList entries(writer);
+    status = header.format == Format::array
+        ? read_array_entries(input_buf, header, entries)
+        : read_entries(input_buf, header, entries, 1);
+    if (!status) {
+        print_parsing_error(status);
+        return EXIT_FAILURE;
     }
 
-    draw_grid(grid, image_config, *opts);
+    entries.flush();
+    writer.finish();
+
+    if (convert_opts.verbose) {
+        header.format = Format::coordinate;
+        header.entries = writer.entries();
+        print_matrix_info(header);
+        std::cout << "Entries written: " << writer.entries() << "\n";
+    }
 
     return EXIT_SUCCESS;
+}
+
+
+int main(int argc, char** argv) {
+    if (argc > 1 && std::string_view(argv[1]) == "convert") {
+        std::optional<ConvertOptions> opts = parse_convert_args(argc, argv);
+        if (!opts) {
+            return EXIT_FAILURE;
+        }
+
+        try {
+            return convert(*opts);
+        } catch (const std::runtime_error& error) {
+            std::cerr << "Error: " << error.what() << "\n";
+            return EXIT_FAILURE;
+        }
+    }
+
+    std::optional<CmdOptions> opts = parse_args(argc, argv);
+
+    if (!opts) {
+        return EXIT_FAILURE;
+    }
+
+    try {
+        return run(*opts);
+    } catch (const std::runtime_error& error) {
+        std::cerr << "Error: " << error.what() << "\n";
+        return EXIT_FAILURE;
+    }
 }
\ No newline at end of file
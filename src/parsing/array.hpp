@@ -0,0 +1,400 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+#include "parsing/status.hpp"
+#include "parsing/scan.hpp"
+#include "parsing/entries.hpp"
+#include "input/source.hpp"
+#include "types.hpp"
+
+
+/*
+ * Reading of dense matrices in the array format.
+ *
+ * The values are stored one per line in column-major order, complex ones
+ * as a pair of numbers. Only the lower triangle of symmetric and hermitian
+ * matrices is stored and skew-symmetric ones leave out the diagonal too.
+ *
+ * The position of a value is given by its index, so the values don't have
+ * to be converted at all, only classified as zero or nonzero. A number is
+ * zero iff its mantissa has no nonzero digit, which is decided for whole
+ * 64 byte blocks at once using SIMD character classes.
+ */
+
+
+/**
+ * Character classes of a block, the bit i describes `block[i]`.
+ *
+ * The letters 'n' and 'i' starting "nan" and "inf" count as nonzero digits.
+ */
+struct ValueMasks {
+    uint64_t newlines;
+    uint64_t digits;
+    uint64_t nonzero_digits;
+    uint64_t exponents;         // 'e' or 'E'
+};
+
+using ValueKernel = ValueMasks (*)(const char* block);
+
+/**
+ * Classifies the first `size` bytes of the block, at most `scan_block_size`.
+ */
+ValueMasks value_masks_partial(const char* block, size_t size) {
+    ValueMasks masks = { 0, 0, 0, 0 };
+    for (size_t i = 0; i < size; ++i) {
+        char c = block[i];
+        char lower = c | 0x20;
+        bool special = lower == 'n' || lower == 'i';
+
+        masks.newlines |= uint64_t(c == '\n') << i;
+        masks.digits |= uint64_t(is_digit(c) || special) << i;
+        masks.nonzero_digits |= uint64_t((is_digit(c) && c != '0') || special) << i;
+        masks.exponents |= uint64_t(lower == 'e') << i;
+    }
+    return masks;
+}
+
+ValueMasks value_masks_scalar(const char* block) {
+    return value_masks_partial(block, scan_block_size);
+}
+
+#ifdef MARC_X86_KERNELS
+
+ValueMasks value_masks_sse2(const char* block) {
+    const __m128i case_bit = _mm_set1_epi8(0x20);
+
+    ValueMasks masks = { 0, 0, 0, 0 };
+    for (size_t i = 0; i < scan_block_size; i += 16) {
+        __m128i chars = _mm_loadu_si128(reinterpret_cast<const __m128i*>(block + i));
+        __m128i lower = _mm_or_si128(chars, case_bit);
+        __m128i special = _mm_or_si128(_mm_cmpeq_epi8(lower, _mm_set1_epi8('n')),
+                                       _mm_cmpeq_epi8(lower, _mm_set1_epi8('i')));
+
+        // unsigned range checks, x <= max iff min(x, max) == x
+        __m128i digit = _mm_sub_epi8(chars, _mm_set1_epi8('0'));
+        digit = _mm_cmpeq_epi8(_mm_min_epu8(digit, _mm_set1_epi8(9)), digit);
+        __m128i nonzero = _mm_sub_epi8(chars, _mm_set1_epi8('1'));
+        nonzero = _mm_cmpeq_epi8(_mm_min_epu8(nonzero, _mm_set1_epi8(8)), nonzero);
+
+        __m128i newline = _mm_cmpeq_epi8(chars, _mm_set1_epi8('\n'));
+        __m128i exponent = _mm_cmpeq_epi8(lower, _mm_set1_epi8('e'));
+
+        masks.newlines |= uint64_t(uint32_t(_mm_movemask_epi8(newline))) << i;
+        masks.digits |= uint64_t(uint32_t(_mm_movemask_epi8(_mm_or_si128(digit, special)))) << i;
+        masks.nonzero_digits |= uint64_t(uint32_t(_mm_movemask_epi8(_mm_or_si128(nonzero, special)))) << i;
+        masks.exponents |= uint64_t(uint32_t(_mm_movemask_epi8(exponent))) << i;
+    }
+    return masks;
+}
+
+__attribute__((target("avx2")))
+ValueMasks value_masks_avx2(const char* block) {
+    const __m256i case_bit = _mm256_set1_epi8(0x20);
+
+    ValueMasks masks = { 0, 0, 0, 0 };
+    for (size_t i = 0; i < scan_block_size; i += 32) {
+        __m256i chars = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(block + i));
+        __m256i lower = _mm256_or_si256(chars, case_bit);
+        __m256i special = _mm256_or_si256(_mm256_cmpeq_epi8(lower, _mm256_set1_epi8('n')),
+                                          _mm256_cmpeq_epi8(lower, _mm256_set1_epi8('i')));
+
+        __m256i digit = _mm256_sub_epi8(chars, _mm256_set1_epi8('0'));
+        digit = _mm256_cmpeq_epi8(_mm256_min_epu8(digit, _mm256_set1_epi8(9)), digit);
+        __m256i nonzero = _mm256_sub_epi8(chars, _mm256_set1_epi8('1'));
+        nonzero = _mm256_cmpeq_epi8(_mm256_min_epu8(nonzero, _mm256_set1_epi8(8)), nonzero);
+
+        __m256i newline = _mm256_cmpeq_epi8(chars, _mm256_set1_epi8('\n'));
+        __m256i exponent = _mm256_cmpeq_epi8(lower, _mm256_set1_epi8('e'));
+
+        masks.newlines |= uint64_t(uint32_t(_mm256_movemask_epi8(newline))) << i;
+        masks.digits |= uint64_t(uint32_t(_mm256_movemask_epi8(_mm256_or_si256(digit, special)))) << i;
+        masks.nonzero_digits |= uint64_t(uint32_t(_mm256_movemask_epi8(_mm256_or_si256(nonzero, special)))) << i;
+        masks.exponents |= uint64_t(uint32_t(_mm256_movemask_epi8(exponent))) << i;
+    }
+    return masks;
+}
+
+__attribute__((target("avx512bw")))
+ValueMasks value_masks_avx512(const char* block) {
+    __m512i chars = _mm512_loadu_si512(block);
+    __m512i lower = _mm512_or_si512(chars, _mm512_set1_epi8(0x20));
+    uint64_t special = _mm512_cmpeq_epi8_mask(lower, _mm512_set1_epi8('n'))
+                     | _mm512_cmpeq_epi8_mask(lower, _mm512_set1_epi8('i'));
+
+    __m512i digit = _mm512_sub_epi8(chars, _mm512_set1_epi8('0'));
+
+    ValueMasks masks;
+    masks.newlines = _mm512_cmpeq_epi8_mask(chars, _mm512_set1_epi8('\n'));
+    masks.digits = _mm512_cmple_epu8_mask(digit, _mm512_set1_epi8(9)) | special;
+    masks.nonzero_digits = (masks.digits & ~_mm512_cmpeq_epi8_mask(chars, _mm512_set1_epi8('0'))) | special;
+    masks.exponents = _mm512_cmpeq_epi8_mask(lower, _mm512_set1_epi8('e'));
+    return masks;
+}
+
+#endif
+
+/**
+ * Picks the best classification kernel for the CPU we are running on.
+ */
+ValueKernel value_kernel() {
+    static const ValueKernel kernel = [] () -> ValueKernel {
+#ifdef MARC_X86_KERNELS
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("avx512bw")) {
+            return value_masks_avx512;
+        }
+        if (__builtin_cpu_supports("avx2")) {
+            return value_masks_avx2;
+        }
+        return value_masks_sse2;
+#else
+        return value_masks_scalar;
+#endif
+    }();
+    return kernel;
+}
+
+
+/**
+ * Classifies the values on one line terminated by '\n' or '\0',
+ * or by `limit`, whichever comes first.
+ * Sets `count` to the number of values and `nonzero` iff any of them
+ * isn't zero.
+ */
+void scan_values(const char* str, const char* limit, size_t& count, bool& nonzero) {
+    count = 0;
+    nonzero = false;
+
+    size_t size = limit - str;
+    size_t i = 0;
+    while (true) {
+        while (i < size && is_blank(str[i])) {
+            ++i;
+        }
+        if (i == size || is_line_end(str[i])) {
+            return;
+        }
+
+        bool mantissa = true;
+        bool has_digits = false;
+        for (; i < size && !is_blank(str[i]) && !is_line_end(str[i]); ++i) {
+            char lower = str[i] | 0x20;
+            bool special = lower == 'n' || lower == 'i';
+            mantissa = mantissa && lower != 'e';
+            has_digits = has_digits || is_digit(str[i]) || special;
+            nonzero = nonzero || (mantissa && ((is_digit(str[i]) && str[i] != '0') || special));
+        }
+        count += has_digits;
+    }
+}
+
+
+/**
+ * Counts the nonzero values of a matrix in the array format into a grid.
+ *
+ * The row and column of every value just follow from the previous one.
+ * The rows of the nonzero values of a column are collected and handed
+ * to the grid in batches by `on_col`.
+ *
+ * Provides `parse_block` and `parse_line` for `parse_chunks`.
+ */
+template<typename Target>
+struct ArrayParser {
+
+    ArrayParser(const Header& header, Target& grid)
+        : header_(header),
+          grid_(grid),
+          kernel_(value_kernel()),
+          line_no_(header.size + 1)
+    {
+        rows_.reserve(column_batch_size);
+        row_ = first_row(0);
+        skip_empty_columns();
+    }
+
+    /**
+     * Parses all complete lines in `[data, end)`. On success `rest` is set
+     * to the start of the trailing incomplete line or to `end` if there is none.
+     */
+    Status parse_block(const char* data, const char* end, const char*& rest) {
+        const char* last_newline = static_cast<const char*>(memrchr(data, '\n', end - data));
+        rest = last_newline ? last_newline + 1 : data;
+
+        if (header_.type == Type::complex) {
+            NewlineScanner newlines(data, rest);
+            while (const char* newline = newlines.next()) {
+                auto status = parse_line(data, newline + 1);
+                if (!status) {
+                    return status;
+                }
+                data = newline + 1;
+            }
+            return Status::success();
+        }
+
+        size_t size = rest - data;
+        for (size_t offset = 0; offset < size; offset += scan_block_size) {
+            size_t count = std::min(scan_block_size, size - offset);
+            ValueMasks masks = count == scan_block_size ? kernel_(data + offset) : value_masks_partial(data + offset, count);
+
+            // the bits of the block which don't belong to any of the previous lines
+            uint64_t line = ~uint64_t(0);
+            for (uint64_t newlines = masks.newlines; newlines; newlines &= newlines - 1) {
+                uint64_t newline = newlines & -newlines;
+                add_segment(masks, line & (newline - 1));
+                if (!end_line()) {
+                    return Status::error("Too many values.", line_no_, 1);
+                }
+                line &= ~(newline | (newline - 1));
+            }
+            add_segment(masks, line);
+        }
+
+        return Status::success();
+    }
+
+    /**
+     * Parses a single line terminated by '\n' or '\0'.
+     * Nothing from `limit` on is read.
+     */
+    Status parse_line(const char* line, const char* limit) {
+        size_t count;
+        bool nonzero;
+        scan_values(line, limit, count, nonzero);
+
+        size_t expected = header_.type == Type::complex ? 2 : 1;
+        if (count != 0 && count != expected) {
+            return Status::error(expected == 2 ? "Expected the real and imaginary part." : "Expected a single value.", line_no_, 1);
+        }
+
+        if (count != 0 && !add_value(nonzero)) {
+            return Status::error("Too many values.", line_no_, 1);
+        }
+
+        ++line_no_;
+        return Status::success();
+    }
+
+    /**
+     * Checks that all values were read.
+     */
+    Status finish() {
+        if (col_ < header_.cols) {
+            return Status::error("Missing values.", line_no_, 1);
+        }
+        return Status::success();
+    }
+
+private:
+    static constexpr size_t column_batch_size = 4096;
+
+    /**
+     * Adds a part of the current line given by `segment` bits of the block.
+     */
+    void add_segment(const ValueMasks& masks, uint64_t segment) {
+        // digits of the exponent don't matter
+        if (!in_exponent_) {
+            uint64_t exponents = masks.exponents & segment;
+            uint64_t mantissa = exponents ? segment & ((exponents & -exponents) - 1) : segment;
+            nonzero_ = nonzero_ || (masks.nonzero_digits & mantissa) != 0;
+            in_exponent_ = exponents != 0;
+        }
+        has_value_ = has_value_ || (masks.digits & segment) != 0;
+    }
+
+    /**
+     * Adds the value of the finished line, if there was any.
+     * Returns false if there are more values than the matrix holds.
+     */
+    bool end_line() {
+        bool added = !has_value_ || add_value(nonzero_);
+        has_value_ = nonzero_ = in_exponent_ = false;
+        if (!added) {
+            return false;
+        }
+        ++line_no_;
+        return true;
+    }
+
+    bool add_value(bool nonzero) {
+        if (col_ == header_.cols) {
+            return false;
+        }
+
+        if (nonzero) {
+            rows_.push_back(row_);
+            if (rows_.size() == column_batch_size) {
+                flush();
+            }
+        }
+
+        if (++row_ == header_.rows) {
+            flush();
+            ++col_;
+            row_ = first_row(col_);
+            skip_empty_columns();
+        }
+
+        return true;
+    }
+
+    void flush() {
+        grid_.on_col(col_, rows_.data(), rows_.size());
+        rows_.clear();
+    }
+
+    size_t first_row(size_t col) const {
+        switch (header_.symmetry) {
+            case Symmetry::general: return 0;
+            case Symmetry::skew_symmetric: return col + 1;
+            default: return col;
+        }
+    }
+
+    void skip_empty_columns() {
+        while (col_ < header_.cols && row_ >= header_.rows) {
+            ++col_;
+            row_ = first_row(col_);
+        }
+    }
+
+    const Header& header_;
+    Target& grid_;
+    ValueKernel kernel_;
+
+    // of the next line
+    size_t line_no_;
+
+    // position of the next value
+    size_t row_ = 0;
+    size_t col_ = 0;
+
+    // nonzero rows of the current column not handed to the grid yet
+    std::vector<size_t> rows_;
+
+    // state of the current line
+    bool has_value_ = false;
+    bool nonzero_ = false;
+    bool in_exponent_ = false;
+};
+
+
+/**
+ * Reads all values remaining in `input` after the header of a matrix
+ * in the array format and adds the nonzero ones into the grid.
+ */
+template<typename Target>
+Status read_array_entries(SourceBuf& input, const Header& header, Target& grid) {
+    ArrayParser<Target> parser(header, grid);
+
+    auto status = parse_chunks(input, parser);
+    if (!status) {
+        return status;
+    }
+
+    return parser.finish();
+}
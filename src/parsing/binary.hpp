@@ -0,0 +1,466 @@
+#pragma once
+
+#include "input/mapped_file.hpp"
+#include "parsing/entries.hpp"
+#include "grid.hpp"
+#include "types.hpp"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <exception>
+#include <fstream>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <utility>
+#include <vector>
+
+
+/**
+ * Native binary format of sparse matrices, which is much faster to read
+ * than the Matrix Market text.
+ *
+ * All numbers are little-endian. The file starts with a fixed header:
+ *
+ *     magic       8 bytes  "MARCCOO1"
+ *     rows        u64
+ *     cols        u64
+ *     entries     u64      as stored, without the mirrored ones
+ *     symmetry    u8
+ *     type        u8       of the original values, which aren't stored
+ *     reserved    6 bytes
+ *     chunks      u64
+ *
+ * followed by a table with the byte offset, byte size and the number of
+ * entries of every chunk, three u64 per chunk, possibly some unused space,
+ * and the chunks themselves.
+ *
+ * The entries are split into chunks which can be decoded independently,
+ * each sorted by rows and then by columns. Within a chunk, each entry is
+ * stored as the difference from the previous row as a LEB128 varint,
+ * followed by the difference from the previous column if the row didn't
+ * change, or by the whole column if it did. Indices are zero-based.
+ */
+namespace binary {
+
+constexpr std::string_view magic = "MARCCOO1";
+constexpr size_t header_size = 48;
+constexpr size_t chunk_entry_size = 24;
+
+// small enough to give every thread several chunks, large enough to make the table negligible
+constexpr size_t default_chunk_entries = 1 << 20;
+
+inline void put_u64(std::string& out, uint64_t val) {
+    char bytes[8];
+    std::memcpy(bytes, &val, 8);
+    out.append(bytes, 8);
+}
+
+inline uint64_t get_u64(const char* data) {
+    uint64_t val;
+    std::memcpy(&val, data, 8);
+    return val;
+}
+
+inline void put_varint(std::string& out, uint64_t val) {
+    while (val >= 0x80) {
+        out.push_back(char(val | 0x80));
+        val >>= 7;
+    }
+    out.push_back(char(val));
+}
+
+[[noreturn]] inline void corrupted() {
+    throw std::runtime_error("The binary matrix is corrupted.");
+}
+
+inline uint64_t get_varint(const uint8_t*& p, const uint8_t* end) {
+    uint64_t val = 0;
+    for (unsigned shift = 0; shift < 64 && p < end; shift += 7) {
+        uint8_t byte = *p++;
+        val |= uint64_t(byte & 0x7F) << shift;
+        if (!(byte & 0x80)) {
+            return val;
+        }
+    }
+    corrupted();
+}
+
+} // namespace binary
+
+
+/**
+ * Writes a matrix in the binary format one chunk at a time, so that only
+ * the chunk being written is held in memory.
+ *
+ * Room for the table of chunks is left after the header, for as many
+ * chunks as the entries declared up front can take. The table and the
+ * final counts of the header are filled in by `finish`. A file which
+ * isn't finished is removed.
+ */
+struct BinaryWriter {
+
+    /**
+     * Creates the file at `path` for a matrix with the given header and
+     * at most `max_entries` entries.
+     * Throws std::runtime_error if the file can't be written.
+     */
+    BinaryWriter(const std::string& path,
+                 const Header& header,
+                 size_t max_entries,
+                 size_t chunk_entries = binary::default_chunk_entries)
+        : path_(path),
+          header_(header),
+          chunk_entries_(chunk_entries),
+          max_chunks_( div_ceil(max_entries, chunk_entries) ),
+          out_(path, std::ios::binary)
+    {
+        offset_ = binary::header_size + max_chunks_*binary::chunk_entry_size;
+        write(std::string(offset_, '\0'));
+    }
+
+    BinaryWriter(const BinaryWriter&) = delete;
+    BinaryWriter& operator=(const BinaryWriter&) = delete;
+
+    ~BinaryWriter() {
+        if (!finished_) {
+            out_.close();
+            std::remove(path_.c_str());
+        }
+    }
+
+    size_t chunk_entries() const {
+        return chunk_entries_;
+    }
+
+    size_t entries() const {
+        return entries_;
+    }
+
+    /**
+     * Sorts the `entries` and writes them as the next chunk.
+     * Throws std::runtime_error if there are more entries than declared.
+     */
+    void write_chunk(std::vector<std::pair<uint64_t, uint64_t>>& entries) {
+        if (chunks_ == max_chunks_) {
+            throw std::runtime_error("The matrix has more entries than its header declares.");
+        }
+
+        std::sort(entries.begin(), entries.end());
+
+        data_.clear();
+        uint64_t row = 0;
+        uint64_t col = 0;
+        for (auto [r, c] : entries) {
+            binary::put_varint(data_, r - row);
+            binary::put_varint(data_, r == row ? c - col : c);
+            row = r;
+            col = c;
+        }
+        write(data_);
+
+        binary::put_u64(table_, offset_);
+        binary::put_u64(table_, data_.size());
+        binary::put_u64(table_, entries.size());
+
+        offset_ += data_.size();
+        entries_ += entries.size();
+        ++chunks_;
+    }
+
+    /**
+     * Writes the header and the table of chunks.
+     * Throws std::runtime_error if the file can't be written.
+     */
+    void finish() {
+        std::string head(binary::magic);
+        binary::put_u64(head, header_.rows);
+        binary::put_u64(head, header_.cols);
+        binary::put_u64(head, entries_);
+        head.push_back(char(header_.symmetry));
+        head.push_back(char(header_.type));
+        head.append(6, '\0');
+        binary::put_u64(head, chunks_);
+
+        out_.seekp(0);
+        write(head);
+        write(table_);
+        out_.close();
+        if (!out_) {
+            fail();
+        }
+        finished_ = true;
+    }
+
+private:
+    void write(const std::string& bytes) {
+        out_.write(bytes.data(), bytes.size());
+        if (!out_) {
+            fail();
+        }
+    }
+
+    [[noreturn]] void fail() const {
+        throw std::runtime_error("Failed to write '" + path_ + "'.");
+    }
+
+    std::string path_;
+    Header header_;
+    size_t chunk_entries_;
+    size_t max_chunks_;
+    std::ofstream out_;
+
+    // the entries of the table written so far
+    std::string table_;
+    // scratch space for encoding a chunk
+    std::string data_;
+
+    size_t offset_;
+    size_t entries_ = 0;
+    size_t chunks_ = 0;
+    bool finished_ = false;
+};
+
+
+/**
+ * Coordinates of the entries, used as the target of the parser
+ * when converting to the binary format.
+ *
+ * Every full chunk of them is handed over to the writer, and so are the
+ * remaining ones by `flush`. Copies share the writer, so the entries have
+ * to be parsed on a single thread.
+ */
+struct EntryList {
+
+    explicit EntryList(BinaryWriter& writer) : writer_(&writer) { }
+
+    void on_entry(size_t row, size_t col) {
+        entries_.emplace_back(row, col);
+        if (entries_.size() == writer_->chunk_entries()) {
+            flush();
+        }
+    }
+
+    template<typename Index>
+    void on_col(size_t col, const Index* rows, size_t count) {
+        for (size_t i = 0; i < count; ++i) {
+            on_entry(rows[i], col);
+        }
+    }
+
+    void clear() {
+        entries_.clear();
+    }
+
+    void merge(const EntryList& other) {
+        for (auto [row, col] : other.entries_) {
+            on_entry(row, col);
+        }
+    }
+
+    void flush() {
+        if (!entries_.empty()) {
+            writer_->write_chunk(entries_);
+            entries_.clear();
+        }
+    }
+
+private:
+    BinaryWriter* writer_;
+    std::vector<std::pair<uint64_t, uint64_t>> entries_;
+};
+
+
+/**
+ * Checks whether the file at `path` starts with the magic of the binary format.
+ */
+bool is_binary_matrix_file(const std::string& path) {
+    std::ifstream file(path, std::ios::binary);
+    char magic[binary::magic.size()];
+    file.read(magic, sizeof(magic));
+    return file && std::string_view(magic, sizeof(magic)) == binary::magic;
+}
+
+
+/**
+ * A memory mapped matrix in the binary format.
+ */
+struct BinaryMatrix {
+
+    /**
+     * Maps and validates the file at `path`.
+     * Throws std::runtime_error if it isn't a valid binary matrix.
+     */
+    explicit BinaryMatrix(const std::string& path) : file_(MappedFile::open_or_throw(path)) {
+        const char* data = file_.data();
+        size_t size = file_.size();
+
+        if (size < binary::header_size || std::string_view(data, binary::magic.size()) != binary::magic) {
+            throw std::runtime_error("'" + path + "' is not a binary matrix.");
+        }
+
+        if (uint8_t(data[32]) > uint8_t(Symmetry::hermitian) || uint8_t(data[33]) > uint8_t(Type::pattern)) {
+            binary::corrupted();
+        }
+
+        header_.format = Format::coordinate;
+        header_.rows = binary::get_u64(data + 8);
+        header_.cols = binary::get_u64(data + 16);
+        header_.entries = binary::get_u64(data + 24);
+        header_.symmetry = Symmetry(data[32]);
+        header_.type = Type(data[33]);
+        header_.size = 0;
+
+        if (header_.symmetry != Symmetry::general && header_.rows != header_.cols) {
+            binary::corrupted();
+        }
+
+        size_t chunks = binary::get_u64(data + 40);
+        if (chunks > (size - binary::header_size) / binary::chunk_entry_size) {
+            binary::corrupted();
+        }
+
+        size_t total = 0;
+        for (size_t i = 0; i < chunks; ++i) {
+            const char* entry = data + binary::header_size + i*binary::chunk_entry_size;
+            ChunkInfo chunk = { binary::get_u64(entry), binary::get_u64(entry + 8), binary::get_u64(entry + 16) };
+            if (chunk.offset > size || chunk.size > size - chunk.offset) {
+                binary::corrupted();
+            }
+            chunks_.push_back(chunk);
+            total += chunk.entries;
+        }
+
+        if (total != header_.entries) {
+            binary::corrupted();
+        }
+    }
+
+    const Header& header() const {
+        return header_;
+    }
+
+    size_t size() const {
+        return file_.size();
+    }
+
+    size_t chunks() const {
+        return chunks_.size();
+    }
+
+    /**
+     * Decodes the `i`-th chunk into `grid`, anything with `on_entry(row, col)`.
+     * Grids get the entries in runs by `on_entries`.
+     */
+    template<typename Target>
+    void decode_chunk(size_t i, Target& grid) const {
+        const ChunkInfo& chunk = chunks_[i];
+        const uint8_t* p = reinterpret_cast<const uint8_t*>(file_.data() + chunk.offset);
+        const uint8_t* end = p + chunk.size;
+
+        uint64_t rows[Grid::entries_run];
+        uint64_t cols[Grid::entries_run];
+        size_t count = 0;
+
+        uint64_t row = 0;
+        uint64_t col = 0;
+        for (size_t k = 0; k < chunk.entries; ++k) {
+            uint64_t row_delta = binary::get_varint(p, end);
+            uint64_t col_val = binary::get_varint(p, end);
+
+            if (row_delta == 0) {
+                col += col_val;
+            } else {
+                row += row_delta;
+                col = col_val;
+            }
+
+            if (row >= header_.rows || col >= header_.cols) {
+                binary::corrupted();
+            }
+
+            if constexpr (takes_batches<Target>::value) {
+                rows[count] = row;
+                cols[count] = col;
+                if (++count == Grid::entries_run) {
+                    grid.on_entries(rows, cols, count);
+                    count = 0;
+                }
+            } else {
+                grid.on_entry(row, col);
+            }
+        }
+
+        if constexpr (takes_batches<Target>::value) {
+            grid.on_entries(rows, cols, count);
+        }
+    }
+
+private:
+    struct ChunkInfo {
+        size_t offset;
+        size_t size;
+        size_t entries;
+    };
+
+    MappedFile file_;
+    Header header_;
+    std::vector<ChunkInfo> chunks_;
+};
+
+
+/**
+ * Reads all entries of a binary matrix into `grid`.
+ *
+ * The chunks are split into contiguous runs decoded by `threads` threads,
+ * each into its own copy of the grid, which are summed at the end.
+ */
+void read_binary_entries(const BinaryMatrix& matrix, Grid& grid, size_t threads) {
+    size_t chunks = matrix.chunks();
+    threads = std::max<size_t>(1, std::min(threads, chunks));
+
+    if (threads == 1) {
+        for (size_t i = 0; i < chunks; ++i) {
+            matrix.decode_chunk(i, grid);
+        }
+        return;
+    }
+
+    std::vector<Grid> partial_grids(threads - 1, grid);
+    for (auto& partial : partial_grids) {
+        partial.clear();
+    }
+
+    std::vector<std::exception_ptr> errors(threads);
+    std::vector<std::thread> workers;
+
+    for (size_t t = 0; t < threads; ++t) {
+        Grid* target = t == 0 ? &grid : &partial_grids[t - 1];
+        workers.emplace_back([&matrix, &errors, t, target, chunks, threads] {
+            try {
+                for (size_t i = t*chunks/threads; i < (t + 1)*chunks/threads; ++i) {
+                    matrix.decode_chunk(i, *target);
+                }
+            } catch (...) {
+                errors[t] = std::current_exception();
+            }
+        });
+    }
+
+    for (auto& worker : workers) {
+        worker.join();
+    }
+
+    for (auto& error : errors) {
+        if (error) {
+            std::rethrow_exception(error);
+        }
+    }
+
+    for (const auto& partial : partial_grids) {
+        grid.merge(partial);
+    }
+}
@@ -0,0 +1,162 @@
+#pragma once
+
+#include "input/mapped_file.hpp"
+#include "grid.hpp"
+#include "types.hpp"
+#include "utils.hpp"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+
+/**
+ * Header of a graph given by an edge list, i.e. a square adjacency matrix
+ * with zero-based indices and no header lines.
+ */
+Header edge_list_header(size_t nodes, size_t edges) {
+    Header header;
+    header.format = Format::coordinate;
+    header.type = Type::pattern;
+    header.symmetry = Symmetry::general;
+    header.rows = nodes;
+    header.cols = nodes;
+    header.entries = edges;
+    header.size = 0;
+    header.index_base = 0;
+    header.comments = true;
+    return header;
+}
+
+
+/**
+ * Number of nodes and edges of a text edge list, gathered by a first pass
+ * of the entry parser over the whole list.
+ */
+struct EdgeListBounds {
+
+    void on_entry(size_t row, size_t col) {
+        nodes = std::max(nodes, std::max(row, col) + 1);
+        ++edges;
+    }
+
+    void clear() {
+        nodes = 0;
+        edges = 0;
+    }
+
+    void merge(const EdgeListBounds& other) {
+        nodes = std::max(nodes, other.nodes);
+        edges += other.edges;
+    }
+
+    size_t nodes = 0;
+    size_t edges = 0;
+};
+
+
+/**
+ * A graph in the serialized format of the GAP benchmark suite,
+ * `.sg` or `.wsg` with weights.
+ *
+ * It is a compressed adjacency list of the out-edges:
+ *
+ *     directed    1 byte
+ *     edges       i64      number of stored neighbors
+ *     nodes       i64
+ *     offsets     i64      (nodes + 1) times
+ *     neighbors   i32      or i32 pairs of a neighbor and a weight in `.wsg`
+ *
+ * Directed graphs then continue with the same for the in-edges, which
+ * are not needed. Undirected graphs store every edge in both directions.
+ */
+struct GapGraph {
+
+    /**
+     * Maps and validates the file at `path`.
+     * Throws std::runtime_error if it isn't a valid serialized graph.
+     */
+    explicit GapGraph(const std::string& path) : file_(MappedFile::open_or_throw(path)) {
+        constexpr size_t fixed_size = 17;
+
+        stride_ = ends_with(path, ".wsg") ? 2 : 1;
+
+        const char* data = file_.data();
+        size_t size = file_.size();
+        if (size < fixed_size) {
+            corrupted();
+        }
+
+        size_t edges = get_i64(data + 1);
+        size_t nodes = get_i64(data + 9);
+
+        // the sizes come from the file, so they are checked before multiplying
+        size_t available = size - fixed_size;
+        if (nodes >= available/8 || edges > (available - (nodes + 1)*8)/(4*stride_)) {
+            corrupted();
+        }
+
+        offsets_ = data + fixed_size;
+        neighbors_ = offsets_ + (nodes + 1)*8;
+        header_ = edge_list_header(nodes, edges);
+    }
+
+    const Header& header() const {
+        return header_;
+    }
+
+    size_t size() const {
+        return file_.size();
+    }
+
+    /**
+     * Adds the out-edges of every node into the grid, one row at a time.
+     */
+    void read_entries(Grid& grid) const {
+        // neighbors are copied out since the file doesn't keep them aligned
+        constexpr size_t batch_size = 4096;
+        uint32_t batch[batch_size];
+
+        size_t prev = 0;
+        for (size_t node = 0; node < header_.rows; ++node) {
+            size_t begin = get_i64(offsets_ + node*8);
+            size_t end = get_i64(offsets_ + (node + 1)*8);
+            if (begin != prev || end < begin || end > header_.entries) {
+                corrupted();
+            }
+            prev = end;
+
+            for (size_t first = begin; first < end; first += batch_size) {
+                size_t count = std::min(batch_size, end - first);
+                for (size_t i = 0; i < count; ++i) {
+                    std::memcpy(&batch[i], neighbors_ + (first + i)*4*stride_, 4);
+                    if (batch[i] >= header_.cols) {
+                        corrupted();
+                    }
+                }
+                grid.on_row(node, batch, count);
+            }
+        }
+    }
+
+private:
+    [[noreturn]] static void corrupted() {
+        throw std::runtime_error("The serialized graph is corrupted.");
+    }
+
+    static uint64_t get_i64(const char* data) {
+        uint64_t val;
+        std::memcpy(&val, data, 8);
+        return val;
+    }
+
+    MappedFile file_;
+    Header header_;
+
+    size_t stride_;     // of the neighbors in 32-bit words
+    const char* offsets_;
+    const char* neighbors_;
+};
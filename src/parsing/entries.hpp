@@ -1,10 +1,21 @@
 #pragma once
 
+#include <fstream>
 #include <istream>
 #include <string>
-#include <array>
+#include <algorithm>
+#include <charconv>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <vector>
 
 #include "parsing/status.hpp"
+#include "parsing/scan.hpp"
+#include "input/source.hpp"
 #include "grid.hpp"
 #include "types.hpp"
 
@@ -14,6 +25,17 @@ bool is_digit(char c) {
     return (x - '0') <= 9;
 }
 
+/**
+ * Whitespace that doesn't end the line.
+ */
+bool is_blank(char c) {
+    return c == ' ' || c == '\t' || c == '\r' || c == '\v' || c == '\f';
+}
+
+bool is_line_end(char c) {
+    return c == '\n' || c == '\0';
+}
+
 /**
  * Extracts an integer from `str` starting from index `i`
  * assigns it into `val` and assigns the first unprocessed index to `end`.
@@ -47,66 +69,234 @@ Status read_int(const char* str, size_t i, size_t& end, size_t& val) {
     return Status::success();
 }
 
+/**
+ * Same as `read_int` but decodes up to 8 digits at once.
+ *
+ * Never reads at or past `limit`. Values that might overflow are handed over
+ * to `read_int`, so the errors are exactly the same.
+ */
+Status read_int_swar(const char* str, const char* limit, size_t i, size_t& end, size_t& val) {
+    // any value with at most 19 digits fits into 64 bits
+    constexpr size_t max_safe_digits = 19;
+    constexpr uint64_t powers_of_10[] = { 1, 10, 100, 1000, 10000, 100000, 1000000, 10000000, 100000000 };
+
+    uint64_t res = 0;
+    size_t digits = 0;
+
+    while (true) {
+        uint64_t bytes = load_8_bytes(str + i + digits, limit);
+        size_t count = count_digits_swar(bytes);
+        if (count == 0) {
+            break;
+        }
+
+        if (digits + count > max_safe_digits) {
+            return read_int(str, i, end, val);
+        }
+
+        res = res*powers_of_10[count] + decode_digits_swar(bytes, count);
+        digits += count;
+
+        if (count < 8) {
+            break;
+        }
+    }
+
+    end = i + digits;
+    val = res;
+
+    return Status::success();
+}
+
+
+/**
+ * Extracts a floating point number from `str` starting from index `i`
+ * after skipping blanks, assigns it into `val` and assigns the first
+ * unprocessed index to `end`.
+ */
+Status read_value(const char* str, const char* limit, size_t i, size_t& end, double& val) {
+    while (is_blank(str[i])) {
+        ++i;
+    }
+
+    // from_chars doesn't take the plus sign
+    const char* begin = str + i + (str[i] == '+');
+    auto [ptr, ec] = std::from_chars(begin, limit, val);
+
+    if (ec == std::errc::result_out_of_range) {
+        // rounds to zero or infinity, which from_chars doesn't do
+        val = std::strtod(begin, nullptr);
+    } else if (ec != std::errc()) {
+        return Status::error("Invalid value.", -1, i + 1);
+    }
+
+    end = ptr - str;
+
+    return Status::success();
+}
+
+
+/**
+ * Whether entries go into the target together with their values,
+ * which targets like `ValueGrid` declare by `reads_values`.
+ */
+template<typename Target, typename = void>
+struct reads_values : std::false_type { };
+
+template<typename Target>
+struct reads_values<Target, std::void_t<decltype(Target::reads_values)>> : std::bool_constant<Target::reads_values> { };
+
+
+/**
+ * Whether the target takes batches of entries by `on_entries`, like `Grid`.
+ * Those carry only the indices, so targets reading values never do.
+ */
+template<typename Target, typename = void>
+struct takes_batches : std::false_type { };
+
+template<typename Target>
+struct takes_batches<Target, std::void_t<decltype(std::declval<Target&>().on_entries(
+        std::declval<const size_t*>(), std::declval<const size_t*>(), size_t()))>>
+    : std::bool_constant<!reads_values<Target>::value> { };
+
+
+/**
+ * Collects parsed entries and passes them on to the target in batches,
+ * so parsing and counting run as separate loops which don't compete for
+ * registers and the instruction cache. The rest is passed on by `flush`.
+ */
+template<typename Target>
+struct EntryBatch {
+
+    explicit EntryBatch(Target& target) : target_(target) { }
+
+    void on_entry(size_t row, size_t col) {
+        rows_[count_] = row;
+        cols_[count_] = col;
+        if (++count_ == capacity) {
+            flush();
+        }
+    }
+
+    void flush() {
+        if (count_ > 0) {
+            target_.on_entries(rows_, cols_, count_);
+            count_ = 0;
+        }
+    }
+
+private:
+    static constexpr size_t capacity = Grid::entries_run;
+
+    Target& target_;
+    size_t rows_[capacity];
+    size_t cols_[capacity];
+    size_t count_ = 0;
+};
+
 
-Status process_entry(const char* str, const Header& header, Grid& grid) {
+/**
+ * Parses one entry line starting at `str` and adds it into the `grid`.
+ *
+ * The line has to be terminated either by '\n' or '\0', anything
+ * following the column index is ignored, as well as blank lines.
+ * So are comments starting with '%' or '#' if the header allows them,
+ * as it does for edge lists. The memory up to `limit` has to be readable.
+ *
+ * The entries can go into anything with `on_entry(row, col)` taking
+ * zero-based indices, usually a `Grid`. Targets which read values take
+ * `on_entry(row, col, magnitude)` instead, with the absolute value of
+ * the entry, 1 for pattern matrices.
+ */
+template<typename Target>
+Status process_entry(const char* str, const char* limit, const Header& header, Target& grid) {
     size_t i = 0;
 
-    while (isspace(str[i])) {
+    while (is_blank(str[i])) {
         ++i;
     }
 
-    if (str[i] == '\0') {
+    if (is_line_end(str[i])) {
         return Status::success();
     }
 
     if (!is_digit(str[i])) {
+        if (header.comments && (str[i] == '%' || str[i] == '#')) {
+            return Status::success();
+        }
         return Status::error("Unexpected character. Expected row index.", -1, i + 1);
     }
 
     size_t start = i;
     size_t row;
     size_t end;
-    auto status = read_int(str, i, end, row);
+    auto status = read_int_swar(str, limit, i, end, row);
     if (!status) {
         return status;
     }
     i = end;
 
-    if (row > header.rows) {
+    // indices below the base wrap around
+    row -= header.index_base;
+    if (row >= header.rows) {
         return Status::error("Row index out of bounds.", -1, start + 1);
     }
 
-    while (isspace(str[i])) {
+    while (is_blank(str[i])) {
         ++i;
     }
 
-    if (str[i] == '\0' || !is_digit(str[i])) {
+    if (!is_digit(str[i])) {
         return Status::error("Unexpected character. Expected column index.", -1, i + 1);
     }
 
     start = i;
     size_t col;
-    status = read_int(str, i, end, col);
+    status = read_int_swar(str, limit, i, end, col);
     if (!status) {
         return status;
     }
 
-    if (col > header.cols) {
+    col -= header.index_base;
+    if (col >= header.cols) {
         return Status::error("Col index out of bounds.", -1, start + 1);
     }
 
-    grid.on_entry(row - 1, col - 1);
+    if constexpr (reads_values<Target>::value) {
+        double magnitude = 1;
+
+        if (header.type != Type::pattern) {
+            status = read_value(str, limit, end, end, magnitude);
+            if (!status) {
+                return status;
+            }
+
+            if (header.type == Type::complex) {
+                double imag;
+                status = read_value(str, limit, end, end, imag);
+                if (!status) {
+                    return status;
+                }
+                magnitude = std::hypot(magnitude, imag);
+            }
+        }
+
+        grid.on_entry(row, col, std::fabs(magnitude));
+    } else {
+        grid.on_entry(row, col);
+    }
 
     return Status::success();
 }
 
 
-Status read_entries_getline(std::ifstream& input, const Header& header, Grid& grid) {
-    size_t line_no = header.size + 1;
+template<typename Target>
+Status read_entries_getline(std::ifstream& input, const Header& header, Target& grid) {
+    size_t line_no = header.size;
     std::string line;
 
     while (std::getline(input, line)) {
-        auto status = process_entry(line.c_str(), header, grid);
+        auto status = process_entry(line.c_str(), line.c_str() + line.size() + 1, header, grid);
         if (!status) {
             status.line = line_no + 1;
             return status;
@@ -118,43 +308,233 @@ Status read_entries_getline(std::ifstream& input, const Header& header, Grid& gr
 }
 
 
-Status read_entries_custom(std::istream& file, const Header& header, Grid& grid) {
-    constexpr size_t buffer_size = 4096;
-    std::array<char, buffer_size> buffer = { 0 };
+/**
+ * Parses the lines in `[data, end)`, the last line has to end with a newline.
+ *
+ * On success `lines` is set to the number of lines in the block. On error
+ * the line number in the returned status is relative to the start
+ * of the block, i.e. 1 means the first line of the block.
+ */
+template<typename Target>
+Status read_lines(const char* data, const char* end, const Header& header, Target& grid, size_t& lines) {
+    if constexpr (takes_batches<Target>::value) {
+        EntryBatch<Target> batch(grid);
+        auto status = read_lines(data, end, header, batch, lines);
+        batch.flush();
+        return status;
+    }
 
-    std::array<char, 1025> line = { 0 };
-    size_t j = 0;
-    size_t line_no = header.size + 1;
+    NewlineScanner newlines(data, end);
+    lines = 0;
 
-    while (true) {
-        file.read(buffer.data(), buffer_size);
-        size_t bytes_read = file.gcount();
+    while (const char* newline = newlines.next()) {
+        auto status = process_entry(data, end, header, grid);
+        if (!status) {
+            status.line = lines + 1;
+            return status;
+        }
+
+        data = newline + 1;
+        ++lines;
+    }
+
+    return Status::success();
+}
+
+
+/**
+ * Parses entries from consecutive blocks of the input and keeps track
+ * of line numbers.
+ *
+ * Large blocks are split at line boundaries into roughly equal ranges which
+ * are parsed by `threads` threads, each into its own grid. The partial grids
+ * are summed into the target grid by `finish`.
+ *
+ * If several ranges contain an error the first one is reported. Since all
+ * ranges before it were parsed completely, their line counts give
+ * the exact line number of the error.
+ *
+ * Besides `on_entry` the target has to be copyable and provide `clear`
+ * and `merge`, like `Grid`.
+ */
+template<typename Target>
+struct BlockParser {
+
+    BlockParser(const Header& header, Target& grid, size_t threads)
+        : header_(header),
+          grid_(grid),
+          threads_(threads),
+          line_no_(header.size) { }
+
+    /**
+     * Parses all complete lines in `[data, end)`. On success `rest` is set
+     * to the start of the trailing incomplete line or to `end` if there is none.
+     */
+    Status parse_block(const char* data, const char* end, const char*& rest) {
+        const char* last_newline = static_cast<const char*>(memrchr(data, '\n', end - data));
+        rest = last_newline ? last_newline + 1 : data;
+
+        size_t size = rest - data;
+        size_t ranges = std::max<size_t>(1, std::min(threads_, size/min_range_size));
+
+        if (ranges == 1) {
+            size_t lines;
+            auto status = read_lines(data, rest, header_, grid_, lines);
+            return advance(status, lines);
+        }
+
+        std::vector<const char*> bounds = { data };
+        for (size_t i = 1; i < ranges; ++i) {
+            const char* split = std::max(bounds.back(), data + i*(size/ranges));
+            const char* newline = static_cast<const char*>(std::memchr(split, '\n', rest - split));
+            bounds.push_back(newline ? newline + 1 : rest);
+        }
+        bounds.push_back(rest);
+
+        // the first range goes directly into the target grid, the rest into empty copies
+        while (partial_grids_.size() < ranges - 1) {
+            partial_grids_.push_back(grid_);
+            partial_grids_.back().clear();
+        }
+
+        std::vector<Status> statuses(ranges);
+        std::vector<size_t> lines(ranges);
+        std::vector<std::thread> workers;
+
+        for (size_t i = 0; i < ranges; ++i) {
+            Target* target = i == 0 ? &grid_ : &partial_grids_[i - 1];
+            workers.emplace_back([&, i, target] {
+                statuses[i] = read_lines(bounds[i], bounds[i + 1], header_, *target, lines[i]);
+            });
+        }
+
+        for (auto& worker : workers) {
+            worker.join();
+        }
 
-        for (size_t i = 0; i < bytes_read; ++i) {
-            if (j >= 1024) {
-                return Status::error("Line is too long (over 1024 chars).", line_no + 1, 1);
+        for (size_t i = 0; i < ranges; ++i) {
+            auto status = advance(statuses[i], lines[i]);
+            if (!status) {
+                return status;
             }
+        }
 
-            line[j++] = buffer[i];
+        return Status::success();
+    }
 
-            if (buffer[i] == '\n') {
-                line[j] = '\0';
-                j = 0;
+    /**
+     * Parses a single line terminated by '\n' or '\0'.
+     * The memory up to `limit` has to be readable.
+     */
+    Status parse_line(const char* line, const char* limit) {
+        auto status = process_entry(line, limit, header_, grid_);
+        if (!status) {
+            status.line = 1;
+        }
+        return advance(status, 1);
+    }
 
-                auto status = process_entry(line.data(), header, grid);
-                if (!status) {
-                    status.line = line_no + 1;
-                    return status;
-                }
+    /**
+     * Sums the partial grids into the target grid.
+     */
+    void finish() {
+        for (const auto& partial : partial_grids_) {
+            grid_.merge(partial);
+        }
+        partial_grids_.clear();
+    }
 
-                ++line_no;
+private:
+    // don't bother splitting small blocks
+    static constexpr size_t min_range_size = 1 << 20;
+
+    Status advance(Status& status, size_t lines) {
+        if (!status) {
+            status.line += line_no_;
+            return status;
+        }
+        line_no_ += lines;
+        return Status::success();
+    }
+
+    const Header& header_;
+    Target& grid_;
+    size_t threads_;
+
+    size_t line_no_;
+
+    std::vector<Target> partial_grids_;
+};
+
+
+/**
+ * Feeds everything remaining in `input` to the `parser`, anything with
+ * `parse_block` and `parse_line` like `BlockParser`.
+ *
+ * The lines are parsed in place in the chunks of the input. Only a line
+ * crossing the boundary of two chunks is stitched together in a separate
+ * buffer, so there is no limit on the length of a line.
+ */
+template<typename Parser>
+Status parse_chunks(SourceBuf& input, Parser& parser) {
+    std::string carry;
+
+    Chunk chunk = input.buffered();
+    if (chunk.size == 0) {
+        chunk = input.next();
+    }
+
+    for (; chunk.size > 0; chunk = input.next()) {
+        const char* data = chunk.data;
+        const char* end = data + chunk.size;
+
+        if (!carry.empty()) {
+            const char* newline = static_cast<const char*>(std::memchr(data, '\n', chunk.size));
+            if (!newline) {
+                carry.append(data, end);
+                continue;
+            }
+
+            carry.append(data, newline + 1);
+            auto status = parser.parse_line(carry.c_str(), carry.c_str() + carry.size() + 1);
+            if (!status) {
+                return status;
             }
+
+            carry.clear();
+            data = newline + 1;
         }
 
-        if (!file) {
-            break;
+        const char* rest;
+        auto status = parser.parse_block(data, end, rest);
+        if (!status) {
+            return status;
         }
+
+        carry.assign(rest, end);
     }
 
+    if (!carry.empty()) {
+        return parser.parse_line(carry.c_str(), carry.c_str() + carry.size() + 1);
+    }
+
+    return Status::success();
+}
+
+
+/**
+ * Reads all entries remaining in `input` after the header.
+ */
+template<typename Target>
+Status read_entries(SourceBuf& input, const Header& header, Target& grid, size_t threads) {
+    BlockParser<Target> parser(header, grid, threads);
+
+    auto status = parse_chunks(input, parser);
+    if (!status) {
+        return status;
+    }
+
+    parser.finish();
+
     return Status::success();
 }
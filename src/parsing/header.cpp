@@ -82,40 +82,33 @@ Status validate_magic_text(LineTokenizer& tokenizer) {
     token = tokenizer.next();
 
     if (!case_insensitive_eq(token.word, "matrix")) {
-        std::string error_msg = "Invalid object declaration. Expected 'matrix' but '" + token.word + "' found.";
-        return Status::error(error_msg, 1, token.start_col + 1);
+        return Status::error("Invalid object declaration. Expected 'matrix'.", 1, token.start_col + 1, token.word);
     }
 
     return Status::success();
 }
 
 
-template<typename Iterable>
-std::string stringify(const Iterable& options) {
-    std::stringstream result_stream;
-    const char* sep = "";
-    for (const auto& item : options) {
-        result_stream << sep << "'" << item << "'";
-        sep = ", ";
-    }
-    return result_stream.str();
-}
-
-
+/**
+ * Parses one of the `options`. The messages list the options, so they
+ * are given by the caller.
+ */
 template<typename Iterable, typename Func>
-Status parse_required_param(LineTokenizer& tokenizer, const Iterable& options, Func on_success) {
+Status parse_required_param(LineTokenizer& tokenizer,
+                            const Iterable& options,
+                            const char* missing_msg,
+                            const char* unexpected_msg,
+                            Func on_success)
+{
     if (!tokenizer.has_next()) {
-        std::string error_msg = "Missing header declaration. Expected one of: " + stringify(options) + "."; 
-        return Status::error(error_msg, 1, tokenizer.current_pos() + 1);
+        return Status::error(missing_msg, 1, tokenizer.current_pos() + 1);
     }
 
     Token token = tokenizer.next();
     size_t i = index_of(token.word, options);
 
     if (i == options.size()) {
-        std::string error_msg = "Unexpected header declaration '" + token.word 
-                              + "'. Expected one of: " + stringify(options) + ".";
-        return Status::error(error_msg, 1, token.start_col + 1);
+        return Status::error(unexpected_msg, 1, token.start_col + 1, token.word);
     }
 
     on_success(i);
@@ -128,7 +121,10 @@ Status parse_format(LineTokenizer& tokenizer, Header& header) {
     std::array<std::string, 2> valid_formats = { "coordinate", "array" };
     std::array<Format, 2> enum_values = { Format::coordinate, Format::array };
 
-    return parse_required_param(tokenizer, valid_formats, [&] (size_t i) { header.format = enum_values[i]; });
+    return parse_required_param(tokenizer, valid_formats,
+        "Missing header declaration. Expected one of: 'coordinate', 'array'.",
+        "Unexpected header declaration. Expected one of: 'coordinate', 'array'.",
+        [&] (size_t i) { header.format = enum_values[i]; });
 }
 
 
@@ -136,7 +132,10 @@ Status parse_type(LineTokenizer& tokenizer, Header& header) {
     std::array<const char*, 4> valid_types = { "integer", "real", "complex", "pattern" };
     std::array<Type, 4> enum_values = { Type::integer, Type::real, Type::complex, Type::pattern };
 
-    return parse_required_param(tokenizer, valid_types, [&] (size_t i) { header.type = enum_values[i]; });
+    return parse_required_param(tokenizer, valid_types,
+        "Missing header declaration. Expected one of: 'integer', 'real', 'complex', 'pattern'.",
+        "Unexpected header declaration. Expected one of: 'integer', 'real', 'complex', 'pattern'.",
+        [&] (size_t i) { header.type = enum_values[i]; });
 }
 
 
@@ -146,7 +145,10 @@ Status parse_symmetry(LineTokenizer& tokenizer, Header& header) {
         Symmetry::general, Symmetry::symmetric, Symmetry::skew_symmetric, Symmetry::hermitian 
     };
 
-    return parse_required_param(tokenizer, valid_symmetries, [&] (size_t i) { header.symmetry = enum_values[i]; });
+    return parse_required_param(tokenizer, valid_symmetries,
+        "Missing header declaration. Expected one of: 'general', 'symmetric', 'skew-symmetric', 'hermitian'.",
+        "Unexpected header declaration. Expected one of: 'general', 'symmetric', 'skew-symmetric', 'hermitian'.",
+        [&] (size_t i) { header.symmetry = enum_values[i]; });
 }
 
 
@@ -168,10 +170,32 @@ Status parse_header_line(std::istream& in, Header& header) {
         return Status::error("Unexpected characters on the header line.", 1, tokenizer.current_pos() + 1);
     }
 
+    if (header.format == Format::array && header.type == Type::pattern) {
+        return Status::error("Pattern matrices can't be stored in the array format.", 1, 1);
+    }
+
     return Status::success();
 }
 
 
+/**
+ * The number of values stored in the array format. Symmetric and hermitian
+ * matrices store only the lower triangle, skew-symmetric ones without
+ * the diagonal.
+ */
+size_t array_entries(const Header& header) {
+    size_t n = header.rows;
+    switch (header.symmetry) {
+        case Symmetry::general:
+            return header.rows*header.cols;
+        case Symmetry::skew_symmetric:
+            return n == 0 ? 0 : n*(n - 1)/2;
+        default:
+            return n*(n + 1)/2;
+    }
+}
+
+
 Status parse_dimensions(std::istream& in, Header& header) {
     size_t line_no = 1;
     std::string line;
@@ -187,13 +211,26 @@ Status parse_dimensions(std::istream& in, Header& header) {
 
         if (!line_stream.eof()) {
             size_t col = line_stream.tellg();
-            line_stream >> header.rows >> header.cols >> header.entries;
+            line_stream >> header.rows >> header.cols;
+
+            // the array format has no count of entries, all of them are stored
+            if (header.format == Format::coordinate) {
+                line_stream >> header.entries;
+            }
 
             if (!line_stream) {
                 return Status::error("Invalid matrix dimensions.", line_no + 1, col + 1);
             }
 
-            header.size = line_no;
+            if (header.symmetry != Symmetry::general && header.rows != header.cols) {
+                return Status::error("Symmetric matrices have to be square.", line_no + 1, col + 1);
+            }
+
+            if (header.format == Format::array) {
+                header.entries = array_entries(header);
+            }
+
+            header.size = line_no + 1;
 
             return Status::success();
         }
@@ -0,0 +1,558 @@
+#pragma once
+
+#include "input/mapped_file.hpp"
+#include "input/zip.hpp"
+#include "grid.hpp"
+#include "types.hpp"
+
+#include <algorithm>
+#include <cctype>
+#include <cstdint>
+#include <cstring>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <vector>
+
+
+/**
+ * A one or two dimensional array in the NumPy `.npy` format
+ * pointing into memory owned by someone else.
+ */
+struct NpyArray {
+    const char* data;
+    char kind;              // 'i', 'u', 'U', 'S', ... as in numpy's dtype.kind
+    size_t item_size;
+    std::vector<size_t> shape;
+
+    size_t count() const {
+        size_t res = 1;
+        for (size_t dim : shape) {
+            res *= dim;
+        }
+        return res;
+    }
+
+    /**
+     * Calls `f` with a pointer to the items converted to their actual
+     * integer type. Throws std::runtime_error if the items aren't integers.
+     *
+     * Stored members of an archive can start at any offset, so misaligned
+     * items are copied to an aligned buffer first.
+     */
+    template<typename F>
+    void visit_integers(F&& f) const {
+        visit_integer_type([&](auto zero) {
+            using Item = decltype(zero);
+            if (reinterpret_cast<uintptr_t>(data) % alignof(Item) == 0) {
+                return f(reinterpret_cast<const Item*>(data));
+            }
+
+            std::vector<Item> items(count());
+            std::memcpy(items.data(), data, items.size()*sizeof(Item));
+            f(static_cast<const Item*>(items.data()));
+        });
+    }
+
+    /**
+     * Returns the `i`-th item, which has to be a non-negative integer.
+     */
+    size_t index_at(size_t i) const {
+        size_t res = 0;
+        visit_integer_type([&](auto item) {
+            std::memcpy(&item, data + i*sizeof(item), sizeof(item));
+            if (item < 0) {
+                throw std::runtime_error("Negative index in the index arrays.");
+            }
+            res = item;
+        });
+        return res;
+    }
+
+    /**
+     * Decodes an array of strings, as scipy stores the name of the format.
+     */
+    std::string string_at(size_t i) const {
+        std::string res;
+        const char* item = data + i*item_size;
+        if (kind == 'S') {
+            res.assign(item, strnlen(item, item_size));
+        } else if (kind == 'U') {
+            // UTF-32, good enough for ASCII
+            for (size_t k = 0; k + 4 <= item_size && item[k] != '\0'; k += 4) {
+                res.push_back(item[k]);
+            }
+        } else {
+            throw std::runtime_error("Expected a string array.");
+        }
+        return res;
+    }
+
+private:
+    /**
+     * Calls `f` with a zero of the integer type of the items.
+     * Throws std::runtime_error if the items aren't integers.
+     */
+    template<typename F>
+    void visit_integer_type(F&& f) const {
+        if (kind == 'i') {
+            switch (item_size) {
+                case 1: return f(int8_t());
+                case 2: return f(int16_t());
+                case 4: return f(int32_t());
+                case 8: return f(int64_t());
+            }
+        } else if (kind == 'u') {
+            switch (item_size) {
+                case 1: return f(uint8_t());
+                case 2: return f(uint16_t());
+                case 4: return f(uint32_t());
+                case 8: return f(uint64_t());
+            }
+        }
+        throw std::runtime_error("The index arrays have to hold integers.");
+    }
+};
+
+
+/**
+ * Parses an array in the `.npy` format stored in `[data, data + size)`.
+ * Only little-endian, C-ordered arrays are supported.
+ * Throws std::runtime_error if the array can't be read.
+ */
+NpyArray parse_npy(const char* data, size_t size) {
+    constexpr std::string_view magic = "\x93NUMPY";
+
+    if (size < 10 || std::string_view(data, magic.size()) != magic) {
+        throw std::runtime_error("Not a .npy array.");
+    }
+
+    uint8_t major = data[6];
+    size_t header_size;
+    size_t offset;
+    if (major == 1) {
+        header_size = uint8_t(data[8]) | uint8_t(data[9]) << 8;
+        offset = 10;
+    } else {
+        if (size < 12) {
+            throw std::runtime_error("Not a .npy array.");
+        }
+        header_size = uint32_t(uint8_t(data[8])) | uint32_t(uint8_t(data[9])) << 8
+                    | uint32_t(uint8_t(data[10])) << 16 | uint32_t(uint8_t(data[11])) << 24;
+        offset = 12;
+    }
+
+    if (size - offset < header_size) {
+        throw std::runtime_error("Truncated .npy array.");
+    }
+
+    // the header is a python dict literal like
+    // {'descr': '<i4', 'fortran_order': False, 'shape': (10,), }
+    std::string_view header(data + offset, header_size);
+    auto value_of = [&header](std::string_view key) {
+        size_t pos = header.find(key);
+        if (pos == std::string_view::npos) {
+            throw std::runtime_error("Invalid .npy header.");
+        }
+        pos = header.find(':', pos + key.size());
+        if (pos == std::string_view::npos) {
+            throw std::runtime_error("Invalid .npy header.");
+        }
+        return header.substr(pos + 1);
+    };
+
+    NpyArray array;
+
+    std::string_view descr = value_of("'descr'");
+    size_t quote = descr.find('\'');
+    if (quote == std::string_view::npos || descr.size() < quote + 4) {
+        throw std::runtime_error("Unsupported .npy data type.");
+    }
+    char order = descr[quote + 1];
+    array.kind = descr[quote + 2];
+    array.item_size = 0;
+    for (size_t i = quote + 3; i < descr.size() && descr[i] >= '0' && descr[i] <= '9'; ++i) {
+        array.item_size = array.item_size*10 + (descr[i] - '0');
+    }
+    if (array.kind == 'U') {
+        array.item_size *= 4;
+    }
+    if (order == '>' && array.item_size > 1 && array.kind != 'S') {
+        throw std::runtime_error("Big-endian .npy arrays are not supported.");
+    }
+
+    std::string_view fortran = value_of("'fortran_order'");
+    size_t fortran_start = fortran.find_first_not_of(' ');
+    if (fortran_start == std::string_view::npos) {
+        throw std::runtime_error("Invalid .npy header.");
+    }
+    if (fortran.substr(fortran_start, 4) == "True") {
+        throw std::runtime_error("Fortran-ordered .npy arrays are not supported.");
+    }
+
+    std::string_view shape = value_of("'shape'");
+    shape = shape.substr(0, shape.find(')'));
+    size_t dim = 0;
+    bool in_number = false;
+    for (char c : shape) {
+        if (c >= '0' && c <= '9') {
+            dim = dim*10 + (c - '0');
+            in_number = true;
+        } else if (in_number) {
+            array.shape.push_back(dim);
+            dim = 0;
+            in_number = false;
+        }
+    }
+    if (in_number) {
+        array.shape.push_back(dim);
+    }
+
+    array.data = data + offset + header_size;
+    if (array.item_size == 0 || (size - offset - header_size) / array.item_size < array.count()) {
+        throw std::runtime_error("Truncated .npy array.");
+    }
+
+    return array;
+}
+
+
+/**
+ * Adds entries given by pairs of index arrays into the grid.
+ */
+void add_coo_entries(const NpyArray& rows, const NpyArray& cols, const Header& header, Grid& grid) {
+    size_t count = rows.count();
+    if (cols.count() != count) {
+        throw std::runtime_error("The row and column arrays have different lengths.");
+    }
+
+    rows.visit_integers([&](auto* row_items) {
+        cols.visit_integers([&](auto* col_items) {
+            // checked a run at a time, which is then added while still in the cache
+            for (size_t first = 0; first < count; first += Grid::entries_run) {
+                size_t n = std::min(Grid::entries_run, count - first);
+                for (size_t i = first; i < first + n; ++i) {
+                    if (row_items[i] < 0 || size_t(row_items[i]) >= header.rows
+                            || col_items[i] < 0 || size_t(col_items[i]) >= header.cols) {
+                        throw std::runtime_error("Index out of bounds in the index arrays.");
+                    }
+                }
+                grid.on_entries(row_items + first, col_items + first, n);
+            }
+        });
+    });
+}
+
+
+/**
+ * Adds the entries of a compressed sparse matrix into the grid.
+ *
+ * For CSR each segment of `indices` given by `indptr` is one row, for CSC
+ * one column, so the whole segment lands in the same row (or column)
+ * of blocks.
+ */
+void add_compressed_entries(const NpyArray& indptr, const NpyArray& indices, bool by_rows, const Header& header, Grid& grid) {
+    size_t segments = by_rows ? header.rows : header.cols;
+    size_t limit = by_rows ? header.cols : header.rows;
+
+    if (indptr.count() != segments + 1) {
+        throw std::runtime_error("The indptr array doesn't match the shape of the matrix.");
+    }
+
+    indptr.visit_integers([&](auto* ptr) {
+        indices.visit_integers([&](auto* items) {
+            size_t count = indices.count();
+            for (size_t s = 0; s < segments; ++s) {
+                if (ptr[s] < 0 || ptr[s] > ptr[s + 1] || size_t(ptr[s + 1]) > count) {
+                    throw std::runtime_error("Invalid indptr array.");
+                }
+
+                auto* begin = items + ptr[s];
+                auto* end = items + ptr[s + 1];
+                for (auto* it = begin; it != end; ++it) {
+                    if (*it < 0 || size_t(*it) >= limit) {
+                        throw std::runtime_error("Index out of bounds in the index arrays.");
+                    }
+                }
+
+                if (by_rows) {
+                    grid.on_row(s, begin, end - begin);
+                } else {
+                    grid.on_col(s, begin, end - begin);
+                }
+            }
+        });
+    });
+}
+
+
+/**
+ * A sparse matrix saved by `scipy.sparse.save_npz`, in the CSR, CSC
+ * or COO format. Only the index arrays are read, the values are never
+ * even decompressed.
+ */
+struct NpzMatrix {
+
+    explicit NpzMatrix(const std::string& path) : archive_(path) {
+        format_ = array("format").string_at(0);
+        if (format_ != "csr" && format_ != "csc" && format_ != "coo") {
+            throw std::runtime_error("Unsupported sparse format '" + format_ + "', only csr, csc and coo are supported.");
+        }
+
+        NpyArray shape = array("shape");
+        if (shape.count() != 2) {
+            throw std::runtime_error("Invalid shape of the sparse matrix.");
+        }
+
+        header_.format = Format::coordinate;
+        header_.type = Type::real;
+        header_.symmetry = Symmetry::general;
+        header_.rows = shape.index_at(0);
+        header_.cols = shape.index_at(1);
+        header_.entries = array(format_ == "coo" ? "row" : "indices").count();
+        header_.size = 0;
+    }
+
+    const Header& header() const {
+        return header_;
+    }
+
+    const std::string& format() const {
+        return format_;
+    }
+
+    size_t size() const {
+        return archive_.size();
+    }
+
+    void read_entries(Grid& grid) {
+        if (format_ == "coo") {
+            add_coo_entries(array("row"), array("col"), header_, grid);
+        } else {
+            add_compressed_entries(array("indptr"), array("indices"), format_ == "csr", header_, grid);
+        }
+    }
+
+private:
+    NpyArray array(const std::string& name) {
+        const ZipEntry* entry = archive_.find(name + ".npy");
+        if (!entry) {
+            throw std::runtime_error("The archive doesn't contain '" + name + ".npy'.");
+        }
+        buffers_.emplace_back();
+        Chunk data = archive_.read(*entry, buffers_.back());
+        return parse_npy(data.data, data.size);
+    }
+
+    ZipArchive archive_;
+    Header header_;
+    std::string format_;
+
+    // decompressed members, kept alive for the arrays pointing into them
+    std::vector<std::vector<char>> buffers_;
+};
+
+
+/**
+ * A sparse matrix saved as separate `.npy` files, like the members of an
+ * `.npz` archive once unzipped: `indptr.npy` and `indices.npy` for CSR or
+ * CSC, `row.npy` and `col.npy` for COO, all sharing a common prefix.
+ *
+ * The format is read from `format.npy` if there is one, otherwise it is
+ * CSR if there is an `indptr.npy` and COO if not. The size of the matrix
+ * is read from `shape.npy`, or given by the indices if it is missing.
+ */
+struct NpyMatrix {
+
+    /**
+     * Returns the prefix shared by the members if `path` names one of them,
+     * or nullopt if it doesn't.
+     */
+    static std::optional<std::string> member_prefix(const std::string& path) {
+        for (const char* member : { "indptr.npy", "indices.npy", "row.npy", "col.npy", "data.npy" }) {
+            if (!ends_with(path, member)) {
+                continue;
+            }
+            std::string prefix = path.substr(0, path.size() - strlen(member));
+            // "protocol.npy" is not a column array
+            if (prefix.empty() || !std::isalnum(static_cast<unsigned char>(prefix.back()))) {
+                return prefix;
+            }
+        }
+        return std::nullopt;
+    }
+
+    explicit NpyMatrix(std::string prefix) : prefix_(std::move(prefix)) {
+        std::optional<NpyArray> format = optional_array("format");
+        if (format) {
+            format_ = format->string_at(0);
+        } else {
+            format_ = MappedFile::open(prefix_ + "indptr.npy") ? "csr" : "coo";
+        }
+        if (format_ != "csr" && format_ != "csc" && format_ != "coo") {
+            throw std::runtime_error("Unsupported sparse format '" + format_ + "', only csr, csc and coo are supported.");
+        }
+
+        header_.format = Format::coordinate;
+        header_.type = Type::pattern;
+        header_.symmetry = Symmetry::general;
+        header_.size = 0;
+
+        if (format_ == "coo") {
+            rows_ = array("row");
+            cols_ = array("col");
+            header_.entries = rows_.count();
+        } else {
+            rows_ = array("indptr");
+            cols_ = array("indices");
+            header_.entries = cols_.count();
+        }
+
+        std::optional<NpyArray> shape = optional_array("shape");
+        if (shape) {
+            if (shape->count() != 2) {
+                throw std::runtime_error("Invalid shape of the sparse matrix.");
+            }
+            header_.rows = shape->index_at(0);
+            header_.cols = shape->index_at(1);
+        } else if (format_ == "coo") {
+            header_.rows = index_limit(rows_);
+            header_.cols = index_limit(cols_);
+        } else {
+            size_t segments = std::max<size_t>(rows_.count(), 1) - 1;
+            header_.rows = format_ == "csr" ? segments : index_limit(cols_);
+            header_.cols = format_ == "csr" ? index_limit(cols_) : segments;
+        }
+    }
+
+    const Header& header() const {
+        return header_;
+    }
+
+    const std::string& format() const {
+        return format_;
+    }
+
+    size_t size() const {
+        size_t res = 0;
+        for (const MappedFile& file : files_) {
+            res += file.size();
+        }
+        return res;
+    }
+
+    void read_entries(Grid& grid) const {
+        if (format_ == "coo") {
+            add_coo_entries(rows_, cols_, header_, grid);
+        } else {
+            add_compressed_entries(rows_, cols_, format_ == "csr", header_, grid);
+        }
+    }
+
+private:
+    NpyArray array(const std::string& name) {
+        std::optional<NpyArray> res = optional_array(name);
+        if (!res) {
+            throw std::runtime_error("Failed to map '" + prefix_ + name + ".npy'.");
+        }
+        return *res;
+    }
+
+    std::optional<NpyArray> optional_array(const std::string& name) {
+        std::optional<MappedFile> file = MappedFile::open(prefix_ + name + ".npy");
+        if (!file) {
+            return std::nullopt;
+        }
+        files_.push_back(std::move(*file));
+        return parse_npy(files_.back().data(), files_.back().size());
+    }
+
+    /**
+     * One past the largest index in `indices`.
+     */
+    static size_t index_limit(const NpyArray& indices) {
+        size_t res = 0;
+        size_t count = indices.count();
+        indices.visit_integers([&](auto* items) {
+            for (size_t i = 0; i < count; ++i) {
+                if (items[i] < 0) {
+                    throw std::runtime_error("Negative index in the index arrays.");
+                }
+                res = std::max<size_t>(res, items[i] + 1);
+            }
+        });
+        return res;
+    }
+
+    std::string prefix_;
+    std::string format_;
+    Header header_;
+
+    // mapped members, kept alive for the arrays pointing into them
+    std::vector<MappedFile> files_;
+    NpyArray rows_;         // row or indptr
+    NpyArray cols_;         // col or indices
+};
+
+
+/**
+ * Coordinates of a sparse matrix in a single `.npy` file, as an integer
+ * array of shape (n, 2) holding zero-based (row, col) pairs. The size of
+ * the matrix is given by the largest indices.
+ */
+struct NpyCoordinates {
+
+    explicit NpyCoordinates(const std::string& path) : file_(MappedFile::open_or_throw(path)), array_(parse_npy(file_.data(), file_.size())) {
+        if (array_.shape.size() == 1) {
+            throw std::runtime_error("A one-dimensional .npy array is read only as a member of a sparse matrix, "
+                                     "named like indptr.npy, indices.npy, row.npy or col.npy.");
+        }
+        if (array_.shape.size() != 2 || array_.shape[1] != 2) {
+            throw std::runtime_error("Expected an array of shape (n, 2) with the coordinates of the entries.");
+        }
+
+        size_t rows = 0;
+        size_t cols = 0;
+        size_t count = array_.shape[0];
+        array_.visit_integers([&](auto* items) {
+            for (size_t i = 0; i < count; ++i) {
+                if (items[2*i] < 0 || items[2*i + 1] < 0) {
+                    throw std::runtime_error("Negative index in the index arrays.");
+                }
+                rows = std::max<size_t>(rows, items[2*i] + 1);
+                cols = std::max<size_t>(cols, items[2*i + 1] + 1);
+            }
+        });
+
+        header_.format = Format::coordinate;
+        header_.type = Type::pattern;
+        header_.symmetry = Symmetry::general;
+        header_.rows = rows;
+        header_.cols = cols;
+        header_.entries = count;
+        header_.size = 0;
+    }
+
+    const Header& header() const {
+        return header_;
+    }
+
+    size_t size() const {
+        return file_.size();
+    }
+
+    void read_entries(Grid& grid) const {
+        size_t count = array_.shape[0];
+        array_.visit_integers([&](auto* items) {
+            for (size_t i = 0; i < count; ++i) {
+                grid.on_entry(items[2*i], items[2*i + 1]);
+            }
+        });
+    }
+
+private:
+    MappedFile file_;
+    NpyArray array_;
+    Header header_;
+};
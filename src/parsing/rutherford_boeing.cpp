@@ -0,0 +1,359 @@
+#include "rutherford_boeing.hpp"
+#include "../utils.hpp"
+
+#include <algorithm>
+#include <cctype>
+#include <optional>
+#include <vector>
+
+
+#define CHECK_STATUS(expr)  \
+    do {                    \
+        auto status = expr; \
+        if (!status) {      \
+            return status;  \
+        }                   \
+    } while(false)
+
+
+namespace {
+
+// the number of header lines before the optional right-hand side line
+constexpr size_t fixed_header_lines = 4;
+
+// the entries of a column are handed to the grid in batches of this size
+constexpr size_t column_batch_size = 4096;
+
+
+std::string field(const std::string& line, size_t start, size_t width) {
+    return start < line.size() ? line.substr(start, width) : std::string();
+}
+
+/**
+ * Parses an integer from a fixed-width field, blank fields are invalid.
+ */
+std::optional<size_t> parse_field(const char* str, size_t width) {
+    size_t i = 0;
+    while (i < width && str[i] == ' ') {
+        ++i;
+    }
+
+    if (i == width || !std::isdigit(static_cast<unsigned char>(str[i]))) {
+        return std::nullopt;
+    }
+
+    size_t res = 0;
+    for (; i < width && std::isdigit(static_cast<unsigned char>(str[i])); ++i) {
+        res = res*10 + (str[i] - '0');
+    }
+
+    while (i < width && str[i] == ' ') {
+        ++i;
+    }
+
+    if (i != width) {
+        return std::nullopt;
+    }
+
+    return res;
+}
+
+/**
+ * Parses an optional integer field of the header, blank means 0.
+ */
+std::optional<size_t> parse_count(const std::string& line, size_t start, size_t width) {
+    std::string str = field(line, start, width);
+    if (str.find_first_not_of(' ') == std::string::npos) {
+        return 0;
+    }
+    str.resize(width, ' ');
+    return parse_field(str.c_str(), width);
+}
+
+/**
+ * Parses descriptors of integer fields like `(16I5)` or `(I10)`.
+ */
+std::optional<FortranIntFormat> parse_int_format(const std::string& descriptor) {
+    size_t i = descriptor.find_first_of("Ii");
+    if (i == std::string::npos) {
+        return std::nullopt;
+    }
+
+    size_t start = i;
+    while (start > 0 && std::isdigit(static_cast<unsigned char>(descriptor[start - 1]))) {
+        --start;
+    }
+
+    FortranIntFormat format = { 1, 0 };
+    if (start < i) {
+        format.per_line = std::stoul(descriptor.substr(start, i - start));
+    }
+
+    size_t end = i + 1;
+    while (end < descriptor.size() && std::isdigit(static_cast<unsigned char>(descriptor[end]))) {
+        ++end;
+    }
+    if (end == i + 1) {
+        return std::nullopt;
+    }
+    format.width = std::stoul(descriptor.substr(i + 1, end - i - 1));
+
+    if (format.per_line == 0 || format.width == 0) {
+        return std::nullopt;
+    }
+
+    return format;
+}
+
+
+/**
+ * Reads integers laid out in fixed-width fields, a given number per line.
+ */
+struct FieldReader {
+
+    FieldReader(std::istream& in, const FortranIntFormat& format, size_t line_no)
+        : in_(in), format_(format), line_no_(line_no), field_(format.per_line) { }
+
+    /**
+     * Reads the next integer into `val`.
+     */
+    Status next(size_t& val) {
+        if (field_ == format_.per_line) {
+            if (!next_line()) {
+                return Status::error("Unexpected end of file.", line_no_, 1);
+            }
+            // trailing blanks are often stripped
+            line_.resize(std::max(line_.size(), format_.per_line*format_.width), ' ');
+            field_ = 0;
+        }
+
+        size_t pos = field_*format_.width;
+        auto res = parse_field(line_.c_str() + pos, format_.width);
+        if (!res) {
+            return Status::error("Invalid integer field.", line_no_, pos + 1);
+        }
+
+        val = *res;
+        ++field_;
+
+        return Status::success();
+    }
+
+    /**
+     * Skips the rest of the lines up to and including line `line_no`.
+     */
+    Status skip_to(size_t line_no) {
+        while (line_no_ < line_no) {
+            if (!next_line()) {
+                return Status::error("Unexpected end of file.", line_no_, 1);
+            }
+        }
+        field_ = format_.per_line;
+        return Status::success();
+    }
+
+    size_t line_no() const {
+        return line_no_;
+    }
+
+private:
+    bool next_line() {
+        if (!std::getline(in_, line_)) {
+            return false;
+        }
+        if (!line_.empty() && line_.back() == '\r') {
+            line_.pop_back();
+        }
+        ++line_no_;
+        return true;
+    }
+
+    std::istream& in_;
+    FortranIntFormat format_;
+
+    std::string line_;
+    size_t line_no_;
+    size_t field_;
+};
+
+} // namespace
+
+
+bool is_rutherford_boeing_path(std::string path) {
+    if (ends_with(path, ".gz")) {
+        path.resize(path.size() - 3);
+    }
+
+    size_t dot = path.find_last_of('.');
+    if (dot == std::string::npos || path.find('/', dot) != std::string::npos) {
+        return false;
+    }
+
+    std::string ext = path.substr(dot + 1);
+    for (auto& c : ext) {
+        c = std::tolower(static_cast<unsigned char>(c));
+    }
+
+    if (ext == "rb" || ext == "hb") {
+        return true;
+    }
+
+    // the matrix type, e.g. 'rua' for a real unsymmetric assembled matrix
+    return ext.size() == 3
+        && std::string("rcpiq").find(ext[0]) != std::string::npos
+        && std::string("usrhz").find(ext[1]) != std::string::npos
+        && ext[2] == 'a';
+}
+
+
+Status parse_rb_header(std::istream& in, RbHeader& rb) {
+    std::vector<std::string> lines(fixed_header_lines);
+    for (size_t i = 0; i < fixed_header_lines; ++i) {
+        if (!std::getline(in, lines[i])) {
+            return Status::error("Missing header.", i + 1, 1);
+        }
+        if (!lines[i].empty() && lines[i].back() == '\r') {
+            lines[i].pop_back();
+        }
+    }
+
+    // line 2: TOTCRD, PTRCRD, INDCRD, VALCRD and, in Harwell-Boeing, RHSCRD
+    auto pointer_lines = parse_count(lines[1], 14, 14);
+    auto index_lines = parse_count(lines[1], 28, 14);
+    auto rhs_lines = parse_count(lines[1], 56, 14);
+    if (!pointer_lines || !index_lines || !rhs_lines) {
+        return Status::error("Invalid line counts.", 2, 1);
+    }
+    rb.pointer_lines = *pointer_lines;
+    rb.index_lines = *index_lines;
+
+    // line 3: MXTYPE, NROW, NCOL, NNZERO, NELTVL
+    std::string type = field(lines[2], 0, 3);
+    for (auto& c : type) {
+        c = std::toupper(static_cast<unsigned char>(c));
+    }
+    if (type.size() != 3) {
+        return Status::error("Missing matrix type.", 3, 1);
+    }
+
+    Header& header = rb.header;
+    header.format = Format::coordinate;
+
+    switch (type[0]) {
+        case 'R': header.type = Type::real; break;
+        case 'C': header.type = Type::complex; break;
+        case 'I': header.type = Type::integer; break;
+        case 'P':
+        case 'Q': header.type = Type::pattern; break;
+        default:
+            return Status::error("Unknown value type. Expected one of 'R', 'C', 'I', 'P' or 'Q'.", 3, 1, type.substr(0, 1));
+    }
+
+    switch (type[1]) {
+        case 'U':
+        case 'R': header.symmetry = Symmetry::general; break;
+        case 'S': header.symmetry = Symmetry::symmetric; break;
+        case 'Z': header.symmetry = Symmetry::skew_symmetric; break;
+        case 'H': header.symmetry = Symmetry::hermitian; break;
+        default:
+            return Status::error("Unknown symmetry. Expected one of 'U', 'R', 'S', 'Z' or 'H'.", 3, 2, type.substr(1, 1));
+    }
+
+    if (type[2] != 'A') {
+        return Status::error("Only assembled matrices are supported.", 3, 3);
+    }
+
+    auto rows = parse_count(lines[2], 14, 14);
+    auto cols = parse_count(lines[2], 28, 14);
+    auto entries = parse_count(lines[2], 42, 14);
+    if (!rows || !cols || !entries) {
+        return Status::error("Invalid matrix dimensions.", 3, 15);
+    }
+    header.rows = *rows;
+    header.cols = *cols;
+    header.entries = *entries;
+
+    if (header.symmetry != Symmetry::general && header.rows != header.cols) {
+        return Status::error("Symmetric matrices have to be square.", 3, 15);
+    }
+
+    // line 4: PTRFMT, INDFMT, VALFMT and RHSFMT
+    auto pointer_format = parse_int_format(field(lines[3], 0, 16));
+    if (!pointer_format) {
+        return Status::error("Invalid format of column pointers.", 4, 1);
+    }
+    auto index_format = parse_int_format(field(lines[3], 16, 16));
+    if (!index_format) {
+        return Status::error("Invalid format of row indices.", 4, 17);
+    }
+    rb.pointer_format = *pointer_format;
+    rb.index_format = *index_format;
+
+    header.size = fixed_header_lines;
+
+    // Harwell-Boeing files with right-hand sides have one more header line
+    if (*rhs_lines > 0) {
+        std::string line;
+        if (!std::getline(in, line)) {
+            return Status::error("Missing right-hand side header.", 5, 1);
+        }
+        header.size++;
+    }
+
+    return Status::success();
+}
+
+
+Status read_rb_entries(std::istream& in, const RbHeader& rb, Grid& grid) {
+    const Header& header = rb.header;
+
+    FieldReader pointers(in, rb.pointer_format, header.size);
+    std::vector<size_t> column_starts(header.cols + 1);
+
+    for (size_t i = 0; i <= header.cols; ++i) {
+        CHECK_STATUS(pointers.next(column_starts[i]));
+
+        size_t prev = i == 0 ? 1 : column_starts[i - 1];
+        if (column_starts[i] != prev && (i == 0 || column_starts[i] < prev)) {
+            return Status::error("Column pointers have to start at 1 and never decrease.", pointers.line_no(), 1);
+        }
+    }
+
+    if (column_starts[header.cols] != header.entries + 1) {
+        return Status::error("The last column pointer doesn't match the number of entries.", pointers.line_no(), 1);
+    }
+
+    // the pointers don't necessarily fill all of their lines
+    CHECK_STATUS(pointers.skip_to(header.size + rb.pointer_lines));
+
+    FieldReader indices(in, rb.index_format, pointers.line_no());
+    std::vector<size_t> rows;
+    rows.reserve(column_batch_size);
+
+    // all entries of a column fall into the same column of blocks,
+    // so they are handed to the grid together
+    size_t k = 0;
+    for (size_t col = 0; col < header.cols; ++col) {
+        size_t end = column_starts[col + 1] - 1;
+
+        for (; k < end; ++k) {
+            size_t row;
+            CHECK_STATUS(indices.next(row));
+
+            if (row == 0 || row > header.rows) {
+                return Status::error("Row index out of bounds.", indices.line_no(), 1);
+            }
+
+            rows.push_back(row - 1);
+            if (rows.size() == column_batch_size) {
+                grid.on_col(col, rows.data(), rows.size());
+                rows.clear();
+            }
+        }
+
+        grid.on_col(col, rows.data(), rows.size());
+        rows.clear();
+    }
+
+    return Status::success();
+}
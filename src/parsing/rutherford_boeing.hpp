@@ -0,0 +1,46 @@
+#pragma once
+
+#include <istream>
+#include <string>
+
+#include "status.hpp"
+#include "../grid.hpp"
+#include "../types.hpp"
+
+
+/**
+ * Layout of integers given by a Fortran format descriptor like `(16I5)`,
+ * i.e. up to 16 fields of width 5 on each line.
+ */
+struct FortranIntFormat {
+    size_t per_line;
+    size_t width;
+};
+
+/**
+ * The header of a matrix in the Rutherford-Boeing or the older
+ * Harwell-Boeing format, both column-compressed.
+ */
+struct RbHeader {
+    Header header;
+
+    size_t pointer_lines;
+    size_t index_lines;
+
+    FortranIntFormat pointer_format;
+    FortranIntFormat index_format;
+};
+
+/**
+ * Checks whether the path has one of the extensions used for Rutherford-Boeing
+ * and Harwell-Boeing files, like `.rb`, `.hb` or `.rua`, possibly followed by `.gz`.
+ */
+bool is_rutherford_boeing_path(std::string path);
+
+Status parse_rb_header(std::istream& in, RbHeader& header);
+
+/**
+ * Reads the column pointers and row indices following the header into the grid.
+ * The values, if any, aren't read.
+ */
+Status read_rb_entries(std::istream& in, const RbHeader& header, Grid& grid);
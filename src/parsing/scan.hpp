@@ -0,0 +1,181 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#define MARC_X86_KERNELS
+#include <immintrin.h>
+#endif
+
+
+/*
+ * Vectorized building blocks of the entry parser.
+ *
+ * Parsing is done in two stages. The first stage finds the newlines
+ * in 64 byte blocks using the widest SIMD instructions the CPU supports,
+ * the second stage decodes the row and column indices of every line
+ * eight digits at a time using SWAR (SIMD within a register).
+ */
+
+
+constexpr size_t scan_block_size = 64;
+
+using ScanKernel = uint64_t (*)(const char* block);
+
+/**
+ * Returns a mask with the bit i set iff `block[i]` is a newline.
+ * The block has to have at least `scan_block_size` readable bytes.
+ */
+uint64_t newline_mask_scalar(const char* block) {
+    uint64_t mask = 0;
+    for (size_t i = 0; i < scan_block_size; ++i) {
+        mask |= uint64_t(block[i] == '\n') << i;
+    }
+    return mask;
+}
+
+#ifdef MARC_X86_KERNELS
+
+uint64_t newline_mask_sse2(const char* block) {
+    const __m128i newline = _mm_set1_epi8('\n');
+    uint64_t mask = 0;
+    for (size_t i = 0; i < scan_block_size; i += 16) {
+        __m128i chars = _mm_loadu_si128(reinterpret_cast<const __m128i*>(block + i));
+        uint32_t bits = _mm_movemask_epi8(_mm_cmpeq_epi8(chars, newline));
+        mask |= uint64_t(bits) << i;
+    }
+    return mask;
+}
+
+__attribute__((target("avx2")))
+uint64_t newline_mask_avx2(const char* block) {
+    const __m256i newline = _mm256_set1_epi8('\n');
+    __m256i lo = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(block));
+    __m256i hi = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(block + 32));
+    uint32_t lo_bits = _mm256_movemask_epi8(_mm256_cmpeq_epi8(lo, newline));
+    uint32_t hi_bits = _mm256_movemask_epi8(_mm256_cmpeq_epi8(hi, newline));
+    return uint64_t(lo_bits) | (uint64_t(hi_bits) << 32);
+}
+
+__attribute__((target("avx512bw")))
+uint64_t newline_mask_avx512(const char* block) {
+    __m512i chars = _mm512_loadu_si512(block);
+    return _mm512_cmpeq_epi8_mask(chars, _mm512_set1_epi8('\n'));
+}
+
+#endif
+
+struct ScanKernelInfo {
+    ScanKernel kernel;
+    const char* name;
+};
+
+/**
+ * Picks the best newline kernel for the CPU we are running on.
+ * The choice is made only once.
+ */
+const ScanKernelInfo& scan_kernel() {
+    static const ScanKernelInfo info = [] () -> ScanKernelInfo {
+#ifdef MARC_X86_KERNELS
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("avx512bw")) {
+            return { newline_mask_avx512, "avx512" };
+        }
+        if (__builtin_cpu_supports("avx2")) {
+            return { newline_mask_avx2, "avx2" };
+        }
+        return { newline_mask_sse2, "sse2" };
+#else
+        return { newline_mask_scalar, "scalar" };
+#endif
+    }();
+    return info;
+}
+
+
+/**
+ * Iterates over the newlines in `[begin, end)` one 64 byte block at a time.
+ */
+struct NewlineScanner {
+
+    NewlineScanner(const char* begin, const char* end)
+        : begin_(begin),
+          size_(end - begin),
+          kernel_(scan_kernel().kernel)
+    {
+        load_block();
+    }
+
+    /**
+     * Returns the next newline or nullptr if there are no more.
+     */
+    const char* next() {
+        while (mask_ == 0) {
+            offset_ += scan_block_size;
+            if (offset_ >= size_) {
+                return nullptr;
+            }
+            load_block();
+        }
+
+        const char* newline = begin_ + offset_ + __builtin_ctzll(mask_);
+        mask_ &= mask_ - 1;
+        return newline;
+    }
+
+private:
+    void load_block() {
+        if (size_ - offset_ >= scan_block_size) {
+            mask_ = kernel_(begin_ + offset_);
+        } else {
+            // the tail is too short for a full load
+            mask_ = 0;
+            for (size_t i = 0; offset_ + i < size_; ++i) {
+                mask_ |= uint64_t(begin_[offset_ + i] == '\n') << i;
+            }
+        }
+    }
+
+    const char* begin_;
+    size_t size_;
+    size_t offset_ = 0;
+    uint64_t mask_ = 0;
+    ScanKernel kernel_;
+};
+
+
+/**
+ * Loads 8 bytes starting at `str` without reading past `limit`.
+ * Missing bytes are zero.
+ */
+uint64_t load_8_bytes(const char* str, const char* limit) {
+    uint64_t bytes = 0;
+    size_t available = limit - str;
+    std::memcpy(&bytes, str, available >= 8 ? 8 : available);
+    return bytes;
+}
+
+/**
+ * Returns the number of consecutive digits at the start of the 8 `bytes`.
+ */
+size_t count_digits_swar(uint64_t bytes) {
+    // a byte is a digit iff its high nibble is 3 and adding 6 keeps it so
+    uint64_t high = (bytes & 0xF0F0F0F0F0F0F0F0) ^ 0x3030303030303030;
+    uint64_t low = ((bytes + 0x0606060606060606) & 0xF0F0F0F0F0F0F0F0) ^ 0x3030303030303030;
+    uint64_t non_digits = high | low;
+    return non_digits == 0 ? 8 : __builtin_ctzll(non_digits)/8;
+}
+
+/**
+ * Converts the first `count` digits in `bytes` into an integer,
+ * `count` has to be between 1 and 8.
+ */
+uint64_t decode_digits_swar(uint64_t bytes, size_t count) {
+    // move the digits to the top so the missing ones act as leading zeros
+    uint64_t digits = (bytes & 0x0F0F0F0F0F0F0F0F) << (8*(8 - count));
+    digits = digits*10 + (digits >> 8);
+    digits = ((digits & 0x00FF00FF00FF00FF)*6553601) >> 16;
+    return ((digits & 0x0000FFFF0000FFFF)*42949672960001) >> 32;
+}
@@ -1,23 +1,60 @@
 #pragma once
 
-#include <string>
+#include <algorithm>
+#include <cstddef>
+#include <cstring>
+#include <string_view>
 
 
+/**
+ * Result of parsing. Errors point to a static message and carry
+ * the position, so statuses are created and passed around on every
+ * entry without ever allocating.
+ *
+ * Errors of the header can also quote the text found instead of what was
+ * expected. It is copied into the status, cut short if it doesn't fit,
+ * since the line it comes from is gone by the time the error is printed.
+ */
 struct Status {
-    bool is_error;
-    std::string error_message;
+    static constexpr size_t max_found_size = 23;
+
+    const char* error_message; // a string literal, nullptr on success
     size_t line;
     size_t col;
+    char found[max_found_size + 1]; // of errors only, empty unless the error quotes the input
 
     operator bool() const {
-        return !is_error;
+        return error_message == nullptr;
+    }
+
+    static Status error(const char* msg, size_t line, size_t col) {
+        Status status = make(msg, line, col);
+        status.found[0] = '\0';
+        return status;
     }
 
-    static Status error(const std::string& msg, size_t line, size_t col) {
-        return { true, msg, line, col };
+    static Status error(const char* msg, size_t line, size_t col, std::string_view found) {
+        Status status = error(msg, line, col);
+        size_t size = std::min(found.size(), max_found_size);
+        std::memcpy(status.found, found.data(), size);
+        status.found[size] = '\0';
+        if (size < found.size()) {
+            std::memcpy(status.found + size - 3, "...", 3);
+        }
+        return status;
     }
 
     static Status success() {
-        return { false };
+        return make(nullptr, 0, 0);
+    }
+
+private:
+    // leaves `found` alone, clearing it on every entry would cost more than the rest
+    static Status make(const char* msg, size_t line, size_t col) {
+        Status status;
+        status.error_message = msg;
+        status.line = line;
+        status.col = col;
+        return status;
     }
 };
@@ -30,5 +30,8 @@ struct Header {
     std::size_t cols;
     std::size_t entries;
 
-    std::size_t size; // size of the header in lines
+    std::size_t size; // size of the header in lines, including the size line
+
+    std::size_t index_base = 1; // of the row and column indices in the file
+    bool comments = false;      // whether '%' and '#' comment lines can follow the header
 };
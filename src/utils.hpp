@@ -21,6 +21,10 @@ inline bool case_insensitive_eq(const std::string& lhs, const std::string& rhs)
     return true;
 }
 
+inline bool ends_with(const std::string& str, const std::string& suffix) {
+    return str.size() >= suffix.size() && str.compare(str.size() - suffix.size(), suffix.size(), suffix) == 0;
+}
+
 template<typename T>
 T div_ceil(T a, T b) {
     return (a + b - 1)/b;
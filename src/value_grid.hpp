@@ -0,0 +1,139 @@
+#pragma once
+
+#include "grid.hpp"
+#include "types.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+
+/**
+ * A grid which besides the number of entries keeps statistics
+ * of the absolute values of the entries in each block.
+ *
+ * Every statistic has its own array next to the counts, so reading
+ * one of them when drawing touches nothing else. Plain `Grid` is left
+ * for renders which only count entries, so they don't pay for any of this.
+ */
+struct ValueGrid : Grid {
+
+    // tells the entry parser to parse the values too
+    static constexpr bool reads_values = true;
+
+    ValueGrid(const Header& header, size_t max_grid_rows, size_t max_grid_cols, bool pow2_blocks = false)
+        : Grid(header, max_grid_rows, max_grid_cols, pow2_blocks),
+          abs_sums_(data_.size(), 0),
+          abs_maxima_(data_.size(), 0),
+          nonzeros_(data_.size(), 0) { }
+
+    /**
+     * Adds an entry with the given absolute value. Mirrored entries
+     * of symmetric, skew-symmetric and hermitian matrices have the same one.
+     */
+    void on_entry(size_t row, size_t col, double magnitude) {
+        visit_layout([&](auto kind, auto symmetric) {
+            add_entry<kind, symmetric>(row, col, magnitude);
+        });
+    }
+
+    void clear() {
+        Grid::clear();
+        abs_sums_.assign(data_.size(), 0);
+        abs_maxima_.assign(data_.size(), 0);
+        nonzeros_.assign(data_.size(), 0);
+    }
+
+    void merge(const ValueGrid& other) {
+        Grid::merge(other);
+        grow();
+        for_each_shared_range(other, [&](size_t first, size_t other_first, size_t n) {
+            for (size_t i = 0; i < n; ++i) {
+                abs_sums_[first + i] += other.abs_sums_[other_first + i];
+                abs_maxima_[first + i] = std::max(abs_maxima_[first + i], other.abs_maxima_[other_first + i]);
+                nonzeros_[first + i] += other.nonzeros_[other_first + i];
+            }
+        });
+    }
+
+    double abs_sum_at(size_t row, size_t col) const {
+        return value_at(abs_sums_, row, col);
+    }
+
+    double abs_max_at(size_t row, size_t col) const {
+        return value_at(abs_maxima_, row, col);
+    }
+
+    size_t nonzeros_at(size_t row, size_t col) const {
+        return value_at(nonzeros_, row, col);
+    }
+
+    double max_abs_sum() const {
+        return max_of(abs_sums_);
+    }
+
+    double max_abs_max() const {
+        return max_of(abs_maxima_);
+    }
+
+    size_t max_nonzeros() const {
+        return max_of(nonzeros_);
+    }
+
+private:
+    template<Divider::Kind K, bool Symmetric>
+    void add_entry(size_t row, size_t col, double magnitude) {
+        size_t block_row = block_divider_.divide<K>(row);
+        size_t block_col = block_divider_.divide<K>(col);
+
+        size_t i;
+        size_t copies = 1;
+        if constexpr (Symmetric) {
+            // like in Grid, the mirror is a second copy only in a diagonal block
+            i = index(std::max(block_row, block_col), std::min(block_row, block_col));
+            copies += row != col && block_row == block_col;
+            entries_count_ += row != col;
+        } else {
+            i = index(block_row, block_col);
+        }
+
+        if (i >= abs_sums_.size()) {
+            grow();
+        }
+        for (size_t k = 0; k < copies; ++k) {
+            increment(i);
+            abs_sums_[i] += magnitude;
+            nonzeros_[i] += magnitude != 0;
+        }
+        abs_maxima_[i] = std::max(abs_maxima_[i], magnitude);
+        entries_count_++;
+    }
+
+    /**
+     * Catches the statistics up with the tiles allocated for the counters.
+     */
+    void grow() {
+        abs_sums_.resize(data_.size(), 0);
+        abs_maxima_.resize(data_.size(), 0);
+        nonzeros_.resize(data_.size(), 0);
+    }
+
+    template<typename T>
+    T value_at(const std::vector<T>& values, size_t row, size_t col) const {
+        size_t i = find(row, col);
+        return i == npos ? 0 : values[i];
+    }
+
+    template<typename T>
+    static T max_of(const std::vector<T>& values) {
+        T res = 0;
+        for (auto x : values) {
+            res = std::max(res, x);
+        }
+        return res;
+    }
+
+    std::vector<double> abs_sums_;
+    std::vector<double> abs_maxima_;
+    std::vector<size_t> nonzeros_;
+};
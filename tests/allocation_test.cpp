@@ -0,0 +1,131 @@
+/**
+ * Checks that parsing entries doesn't allocate, successful or not, and that
+ * header errors still quote the text which was found instead.
+ *
+ * Every allocation goes through the replaced global operator new, which
+ * counts them.
+ */
+
+#include "parsing/entries.hpp"
+#include "parsing/header.hpp"
+#include "value_grid.hpp"
+
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <new>
+#include <sstream>
+#include <string>
+
+
+static size_t allocations = 0;
+
+void* operator new(size_t size) {
+    ++allocations;
+    if (void* ptr = std::malloc(size ? size : 1)) {
+        return ptr;
+    }
+    throw std::bad_alloc();
+}
+
+void operator delete(void* ptr) noexcept {
+    std::free(ptr);
+}
+
+void operator delete(void* ptr, size_t) noexcept {
+    std::free(ptr);
+}
+
+
+static int failures = 0;
+
+void check(bool ok, const char* what) {
+    if (!ok) {
+        std::cerr << "FAILED: " << what << "\n";
+        ++failures;
+    }
+}
+
+
+Header coordinate_header(Type type) {
+    Header header;
+    header.format = Format::coordinate;
+    header.type = type;
+    header.symmetry = Symmetry::general;
+    header.rows = 1000;
+    header.cols = 1000;
+    header.entries = 0;
+    header.size = 2;
+    return header;
+}
+
+std::string entry_lines(size_t count, bool values) {
+    std::string lines;
+    for (size_t i = 0; i < count; ++i) {
+        lines += std::to_string(i*7 % 1000 + 1) + " " + std::to_string(i*13 % 1000 + 1);
+        lines += values ? " -1.5e3\n" : "\n";
+    }
+    return lines;
+}
+
+/**
+ * Parses `lines` into `grid` and returns the number of allocations it took.
+ */
+template<typename Target>
+size_t allocations_parsing(const std::string& lines, const Header& header, Target& grid, Status& status) {
+    BlockParser<Target> parser(header, grid, 1);
+    const char* rest;
+
+    size_t before = allocations;
+    status = parser.parse_block(lines.data(), lines.data() + lines.size(), rest);
+    return allocations - before;
+}
+
+
+void test_entries_dont_allocate() {
+    // initializes the scan kernel, which happens once per program
+    scan_kernel();
+
+    Header pattern = coordinate_header(Type::pattern);
+    std::string lines = entry_lines(100000, false);
+    Grid grid(pattern, 100, 100);
+    Status status;
+    check(allocations_parsing(lines, pattern, grid, status) == 0, "parsing pattern entries allocates");
+    check(status && grid.entries() == 100000, "pattern entries are parsed");
+
+    Header real = coordinate_header(Type::real);
+    std::string value_lines = entry_lines(100000, true);
+    ValueGrid value_grid(real, 100, 100);
+    check(allocations_parsing(value_lines, real, value_grid, status) == 0, "parsing entries with values allocates");
+    check(status && value_grid.entries() == 100000, "entries with values are parsed");
+
+    std::string bad_lines = entry_lines(1000, false) + "1 x\n";
+    Grid bad_grid(pattern, 100, 100);
+    check(allocations_parsing(bad_lines, pattern, bad_grid, status) == 0, "reporting a bad entry allocates");
+    check(!status && status.line == pattern.size + 1001 && status.col == 3, "a bad entry is reported at its line");
+}
+
+
+void test_header_errors_quote_input() {
+    Header header;
+
+    std::istringstream bad_format("%%MatrixMarket matrix coordinat real general\n1 1 0\n");
+    Status status = parse_header(bad_format, header);
+    check(!status && std::strcmp(status.found, "coordinat") == 0, "unknown format is quoted");
+
+    std::istringstream bad_object("%%MatrixMarket tensor coordinate real general\n1 1 0\n");
+    status = parse_header(bad_object, header);
+    check(!status && std::strcmp(status.found, "tensor") == 0, "unknown object is quoted");
+
+    std::istringstream long_symmetry("%%MatrixMarket matrix coordinate real averyveryverylongsymmetryname\n1 1 0\n");
+    status = parse_header(long_symmetry, header);
+    check(!status && std::strlen(status.found) == Status::max_found_size
+          && std::strcmp(status.found + Status::max_found_size - 3, "...") == 0, "long text is cut short");
+}
+
+
+int main() {
+    test_entries_dont_allocate();
+    test_header_errors_quote_input();
+    return failures == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,124 @@
+/**
+ * Renders a tar archive whose first member is a large binary blob without
+ * a single newline, followed by a small matrix. The blob has to be skipped
+ * without being read into memory.
+ *
+ * Usage: archive_test <marc binary> <scratch directory>
+ */
+
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+
+constexpr size_t block_size = 512;
+constexpr size_t blob_size = size_t(64) << 20;
+
+// the blob alone is more than that
+constexpr long max_rss_kb = 48 * 1024;
+
+
+void write_member_header(std::ofstream& out, const std::string& name, size_t size) {
+    char header[block_size] = {};
+    std::snprintf(header, 100, "%s", name.c_str());
+    std::snprintf(header + 100, 8, "%07o", 0644);
+    std::snprintf(header + 108, 8, "%07o", 0);
+    std::snprintf(header + 116, 8, "%07o", 0);
+    std::snprintf(header + 124, 12, "%011zo", size);
+    std::snprintf(header + 136, 12, "%011o", 0);
+    header[156] = '0';
+    std::memcpy(header + 257, "ustar", 6);
+    std::memcpy(header + 263, "00", 2);
+
+    // computed with the checksum field itself filled with spaces
+    std::memset(header + 148, ' ', 8);
+    unsigned sum = 0;
+    for (unsigned char c : header) {
+        sum += c;
+    }
+    std::snprintf(header + 148, 8, "%06o", sum);
+
+    out.write(header, block_size);
+}
+
+void write_padding(std::ofstream& out, size_t size) {
+    std::vector<char> zeros(block_size, '\0');
+    out.write(zeros.data(), (block_size - size % block_size) % block_size);
+}
+
+void write_archive(const std::string& path) {
+    std::ofstream out(path, std::ios::binary);
+
+    write_member_header(out, "blob.bin", blob_size);
+    std::vector<char> piece(1 << 20, 'x');
+    for (size_t written = 0; written < blob_size; written += piece.size()) {
+        out.write(piece.data(), piece.size());
+    }
+    write_padding(out, blob_size);
+
+    std::string matrix = "%%MatrixMarket matrix coordinate pattern general\n"
+                         "3 3 3\n"
+                         "1 1\n"
+                         "2 2\n"
+                         "3 3\n";
+    write_member_header(out, "matrix.mtx", matrix.size());
+    out.write(matrix.data(), matrix.size());
+    write_padding(out, matrix.size());
+
+    std::vector<char> end(2*block_size, '\0');
+    out.write(end.data(), end.size());
+}
+
+
+int main(int argc, char** argv) {
+    if (argc != 3) {
+        std::cerr << "Usage: " << argv[0] << " <marc binary> <scratch directory>\n";
+        return 1;
+    }
+
+    std::filesystem::path dir = argv[2];
+    std::filesystem::remove_all(dir);
+    std::filesystem::create_directories(dir);
+
+    std::string archive = (dir / "archive.tar").string();
+    std::string output = (dir / "images").string();
+    write_archive(archive);
+
+    pid_t pid = fork();
+    if (pid == 0) {
+        execl(argv[1], argv[1], archive.c_str(), "-o", output.c_str(), "-f", "bmp", (char*)nullptr);
+        _exit(127);
+    }
+
+    int status;
+    struct rusage usage;
+    if (pid < 0 || wait4(pid, &status, 0, &usage) != pid) {
+        std::cerr << "Failed to run " << argv[1] << ".\n";
+        return 1;
+    }
+
+    int res = 0;
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+        std::cerr << "Rendering the archive failed.\n";
+        res = 1;
+    }
+    if (!std::filesystem::exists(dir / "images" / "matrix.bmp")) {
+        std::cerr << "The matrix after the blob wasn't rendered.\n";
+        res = 1;
+    }
+    if (usage.ru_maxrss > max_rss_kb) {
+        std::cerr << "Peak memory was " << usage.ru_maxrss / 1024 << " MB, the blob must have been read.\n";
+        res = 1;
+    }
+
+    std::filesystem::remove_all(dir);
+    return res;
+}
@@ -0,0 +1,209 @@
+/**
+ * Measures how fast entries are added into grids of several sizes, with
+ * the entries added directly and held back for the partitioned batches,
+ * one by one by `on_entry` and in runs by `on_entries`. Then compares
+ * dense grids stored row by row with the same grids split into tiles,
+ * both in adding the entries and in visiting the blocks for drawing.
+ *
+ * Not a test, it only prints the nanoseconds per entry:
+ *
+ *     grid_bench [log2 of the number of entries] [pattern]
+ *
+ * Every block of the grids is 4x4 entries of the matrix, which holds
+ * random entries in one of these patterns:
+ *
+ *     random     in random order
+ *     rows       sorted by rows, like most Matrix Market files
+ *     cols       sorted by columns
+ *     band       within a band around the diagonal, sorted by rows
+ *     blockdiag  within blocks on the diagonal, one block after another
+ */
+
+#include "grid.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <optional>
+#include <random>
+#include <string>
+#include <utility>
+#include <vector>
+
+
+struct Entries {
+    std::vector<uint32_t> rows;
+    std::vector<uint32_t> cols;
+};
+
+
+Entries make_entries(const std::string& pattern, size_t n, size_t count) {
+    std::mt19937_64 rng(1);
+    std::vector<std::pair<uint32_t, uint32_t>> entries(count);
+
+    if (pattern == "band") {
+        size_t width = n/64;
+        for (auto& [row, col] : entries) {
+            row = rng() % n;
+            size_t first = row < width ? 0 : row - width;
+            col = std::min(n - 1, first + rng() % (2*width + 1));
+        }
+    } else if (pattern == "blockdiag") {
+        size_t side = n/16;
+        for (size_t i = 0; i < count; ++i) {
+            size_t first = i*16/count*side;
+            entries[i] = { first + rng() % side, first + rng() % side };
+        }
+    } else {
+        for (auto& [row, col] : entries) {
+            row = rng() % n;
+            col = rng() % n;
+        }
+    }
+
+    if (pattern == "rows" || pattern == "band") {
+        std::sort(entries.begin(), entries.end());
+    } else if (pattern == "cols") {
+        std::sort(entries.begin(), entries.end(), [](auto a, auto b) {
+            return std::make_pair(a.second, a.first) < std::make_pair(b.second, b.first);
+        });
+    }
+
+    Entries res;
+    for (auto [row, col] : entries) {
+        res.rows.push_back(row);
+        res.cols.push_back(col);
+    }
+    return res;
+}
+
+
+/**
+ * Best time of a few runs adding all `entries` into a new grid, in ns per entry.
+ * The entries are batched as the grid decides, unless `batched` says otherwise.
+ */
+double measure(const Header& header, size_t side, const Entries& entries, std::optional<bool> batched, bool runs,
+               bool tiles = false) {
+    size_t count = entries.rows.size();
+    double best = 1e300;
+    for (int rep = 0; rep < 5; ++rep) {
+        Grid grid(header, side, side, false, tiles);
+        if (batched) {
+            grid.set_batched(*batched);
+        }
+
+        auto start = std::chrono::steady_clock::now();
+        if (runs) {
+            grid.on_entries(entries.rows.data(), entries.cols.data(), count);
+        } else {
+            for (size_t i = 0; i < count; ++i) {
+                grid.on_entry(entries.rows[i], entries.cols[i]);
+            }
+        }
+        grid.flush();
+        std::chrono::duration<double> time = std::chrono::steady_clock::now() - start;
+
+        if (grid.entries() != count) {
+            std::fprintf(stderr, "Lost some entries.\n");
+            std::exit(EXIT_FAILURE);
+        }
+        best = std::min(best, time.count());
+    }
+    return best*1e9/count;
+}
+
+
+/**
+ * Best time of a few runs visiting the blocks of a grid holding `entries`
+ * the way the drawers do, in ns per block.
+ */
+double measure_drawing(const Header& header, size_t side, const Entries& entries, bool tiles) {
+    Grid grid(header, side, side, false, tiles);
+    grid.on_entries(entries.rows.data(), entries.cols.data(), entries.rows.size());
+    grid.flush();
+
+    double best = 1e300;
+    size_t sum = 0;
+    for (int rep = 0; rep < 5; ++rep) {
+        auto start = std::chrono::steady_clock::now();
+        grid.for_each_block([&](size_t row, size_t col) {
+            sum += grid.count_at(row, col);
+        });
+        std::chrono::duration<double> time = std::chrono::steady_clock::now() - start;
+        best = std::min(best, time.count());
+    }
+
+    if (sum != 5*entries.rows.size()) {
+        std::fprintf(stderr, "Lost some entries.\n");
+        std::exit(EXIT_FAILURE);
+    }
+    return best*1e9/(grid.rows()*grid.cols());
+}
+
+
+Header square_header(size_t n, size_t entries) {
+    Header header;
+    header.format = Format::coordinate;
+    header.type = Type::pattern;
+    header.symmetry = Symmetry::general;
+    header.rows = header.cols = n;
+    header.entries = entries;
+    header.size = 0;
+    return header;
+}
+
+
+bool skipped(int argc, char** argv, const char* pattern) {
+    return argc > 2 && argv[2] != std::string(pattern);
+}
+
+
+int main(int argc, char** argv) {
+    size_t count = size_t(1) << (argc > 1 ? std::atoi(argv[1]) : 24);
+
+    std::printf("%-10s %6s %7s   %8s %8s   %8s %8s\n", "", "", "", "on_entry", "", "on_entries", "");
+    std::printf("%-10s %6s %7s   %8s %8s   %8s %8s\n", "pattern", "side", "layout", "direct", "batched", "direct", "batched");
+
+    for (const char* pattern : { "random", "rows", "cols", "band", "blockdiag" }) {
+        if (skipped(argc, argv, pattern)) {
+            continue;
+        }
+        for (size_t side : { 512, 1024, 2048, 4096, 8192 }) {
+            Header header = square_header(side*4, count);
+            Entries entries = make_entries(pattern, side*4, count);
+            bool tiled = Grid(header, side, side).tiled();
+
+            std::printf("%-10s %6zu %7s   %8.2f %8.2f   %8.2f ", pattern, side, tiled ? "tiled" : "dense",
+                        measure(header, side, entries, false, false), measure(header, side, entries, true, false),
+                        measure(header, side, entries, false, true));
+            // dense grids add runs directly either way
+            if (tiled) {
+                std::printf("%8.2f\n", measure(header, side, entries, true, true));
+            } else {
+                std::printf("%8s\n", "-");
+            }
+            std::fflush(stdout);
+        }
+    }
+
+    std::printf("\n%-10s %6s   %8s %8s   %8s %8s   %8s %8s\n", "", "", "on_entry", "", "on_entries", "", "drawing", "");
+    std::printf("%-10s %6s   %8s %8s   %8s %8s   %8s %8s\n", "pattern", "side", "by rows", "tiles", "by rows", "tiles", "by rows", "tiles");
+
+    for (const char* pattern : { "random", "rows", "cols", "band", "blockdiag" }) {
+        if (skipped(argc, argv, pattern)) {
+            continue;
+        }
+        for (size_t side : { 1024, 2048, 4096 }) {
+            Header header = square_header(side*4, count);
+            Entries entries = make_entries(pattern, side*4, count);
+
+            std::printf("%-10s %6zu   %8.2f %8.2f   %8.2f %8.2f   %8.2f %8.2f\n", pattern, side,
+                        measure(header, side, entries, std::nullopt, false), measure(header, side, entries, std::nullopt, false, true),
+                        measure(header, side, entries, std::nullopt, true), measure(header, side, entries, std::nullopt, true, true),
+                        measure_drawing(header, side, entries, false), measure_drawing(header, side, entries, true));
+            std::fflush(stdout);
+        }
+    }
+}